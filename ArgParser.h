@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <string>
 #include <glm\vec3.hpp>
+#include "RadiosityOptions.h"
 using namespace std;
 
 class ArgParser
@@ -124,10 +125,148 @@ public:
 				assert (i < argc);
 				numSubdivisions = atoi(argv[i]);
 			}
+			else if (!strcmp(argv[i],"-adaptive")) 
+			{
+				i++;
+				assert (i < argc);
+				adaptivePasses = atoi(argv[i]);
+			}
 			else if (!strcmp(argv[i],"-interpolate")) 
 			{
 				interpolate = true;
 			}
+			else if (!strcmp(argv[i],"-async")) 
+			{
+				asyncSolve = true;
+			}
+			else if (!strcmp(argv[i],"-indexed")) 
+			{
+				indexedVertices = true;
+			}
+			else if (!strcmp(argv[i],"-headless")) 
+			{
+				headless = true;
+			}
+			else if (!strcmp(argv[i],"-results")) 
+			{
+				i++;
+				assert (i < argc);
+				resultsFile = argv[i];
+			}
+			else if (!strcmp(argv[i],"-image")) 
+			{
+				i++;
+				assert (i < argc);
+				imageFile = argv[i];
+			}
+			else if (!strcmp(argv[i],"-solver")) 
+			{
+				i++;
+				assert (i < argc);
+				if (!strcmp(argv[i],"inverse"))
+					radiosityOptions.solver = SOLVER_MATRIX_INVERSE;
+				else if (!strcmp(argv[i],"progressive"))
+					radiosityOptions.solver = SOLVER_PROGRESSIVE;
+				else if (!strcmp(argv[i],"lu"))
+					radiosityOptions.solver = SOLVER_LU;
+				else if (!strcmp(argv[i],"jacobi"))
+					radiosityOptions.solver = SOLVER_JACOBI;
+				else if (!strcmp(argv[i],"gaussseidel"))
+					radiosityOptions.solver = SOLVER_GAUSS_SEIDEL;
+				else if (!strcmp(argv[i],"hierarchical"))
+					radiosityOptions.solver = SOLVER_HIERARCHICAL;
+				else
+				{
+					printf("Unknown solver '%s'\n", argv[i]);
+					assert(0);
+				}
+			}
+			else if (!strcmp(argv[i],"-backend")) 
+			{
+				i++;
+				assert (i < argc);
+				if (!strcmp(argv[i],"cpu"))
+					radiosityOptions.backend = BACKEND_CPU_BVH;
+				else if (!strcmp(argv[i],"gpu"))
+					radiosityOptions.backend = BACKEND_GPU;
+				else if (!strcmp(argv[i],"simd"))
+					radiosityOptions.backend = BACKEND_CPU_SIMD;
+				else
+				{
+					printf("Unknown form factor backend '%s'\n", argv[i]);
+					assert(0);
+				}
+			}
+			else if (!strcmp(argv[i],"-sampler")) 
+			{
+				i++;
+				assert (i < argc);
+				if (!strcmp(argv[i],"random"))
+					radiosityOptions.sampleSequence = SAMPLES_RANDOM;
+				else if (!strcmp(argv[i],"stratified"))
+					radiosityOptions.sampleSequence = SAMPLES_STRATIFIED;
+				else if (!strcmp(argv[i],"halton"))
+					radiosityOptions.sampleSequence = SAMPLES_HALTON;
+				else if (!strcmp(argv[i],"sobol"))
+					radiosityOptions.sampleSequence = SAMPLES_SOBOL;
+				else
+				{
+					printf("Unknown sampler '%s'\n", argv[i]);
+					assert(0);
+				}
+			}
+			else if (!strcmp(argv[i],"-adaptivesamples")) 
+			{
+				radiosityOptions.adaptiveSampling = true;
+			}
+			else if (!strcmp(argv[i],"-reciprocity")) 
+			{
+				i++;
+				assert (i < argc);
+				if (!strcmp(argv[i],"off"))
+					radiosityOptions.reciprocity = RECIPROCITY_OFF;
+				else if (!strcmp(argv[i],"combine"))
+					radiosityOptions.reciprocity = RECIPROCITY_COMBINE;
+				else if (!strcmp(argv[i],"half"))
+					radiosityOptions.reciprocity = RECIPROCITY_HALF;
+				else
+				{
+					printf("Unknown reciprocity mode '%s'\n", argv[i]);
+					assert(0);
+				}
+			}
+			else if (!strcmp(argv[i],"-maxiter")) 
+			{
+				i++;
+				assert (i < argc);
+				radiosityOptions.maxIterations = atoi(argv[i]);
+			}
+			else if (!strcmp(argv[i],"-tol")) 
+			{
+				i++;
+				assert (i < argc);
+				radiosityOptions.toleranceScale = atof(argv[i]);
+			}
+			else if (!strcmp(argv[i],"-ffcache")) 
+			{
+				i++;
+				assert (i < argc);
+				radiosityOptions.formFactorCacheDir = argv[i];
+			}
+			else if (!strcmp(argv[i],"-ffexport")) 
+			{
+				i++;
+				assert (i < argc);
+				radiosityOptions.formFactorExportFile = argv[i];
+				radiosityOptions.formFactorExportFormat = EXPORT_SPARSE;
+				if (i + 1 < argc && !strcmp(argv[i + 1], "dense"))
+				{
+					radiosityOptions.formFactorExportFormat = EXPORT_DENSE;
+					i++;
+				}
+				else if (i + 1 < argc && !strcmp(argv[i + 1], "sparse"))
+					i++;
+			}
 			else
 			{
 				printf("Error on command line argument %d: '%s'\n", i, argv[i]);
@@ -150,8 +289,15 @@ public:
 	float mouseSpeed;
 	glm::vec3 bgcolor;
 	bool interpolate;
+	bool indexedVertices; // shared vertices and a real index buffer for drawing
+	bool asyncSolve; // the viewer keeps drawing while the solver runs in the background
 	int numIterations;
 	int numSubdivisions;
+	int adaptivePasses; // solve and split only the patches on gradients or shadow boundaries, after the uniform subdivisions
+	bool headless; // solve without a window or GL context
+	string resultsFile; // per patch radiosity written by headless runs
+	string imageFile; // optional software rendered image for headless runs
+	RadiosityOptions radiosityOptions;
 private:
 	void DefaultValues()
 	{
@@ -170,8 +316,12 @@ private:
 		mouseSpeed = 0.0005f;
 		bgcolor = glm::vec3(0.0f, 0.0f, 0.4f);
 		interpolate = true;
+		indexedVertices = false;
+		asyncSolve = false;
 		numIterations = 0;
 		numSubdivisions = 0;
+		adaptivePasses = 0;
+		headless = false;
 	}
 };
 
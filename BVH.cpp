@@ -0,0 +1,337 @@
+#include "BVH.h"
+
+#include <float.h>
+#include <math.h>
+#include <algorithm>
+
+static float surfaceArea(glm::vec3 boundsMin, glm::vec3 boundsMax)
+{
+	glm::vec3 extent = boundsMax - boundsMin;
+	return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+}
+
+static void growBounds(glm::vec3& boundsMin, glm::vec3& boundsMax, BVHTriangle& triangle)
+{
+	glm::vec3 v1 = triangle.v0 + triangle.edge1;
+	glm::vec3 v2 = triangle.v0 + triangle.edge2;
+
+	boundsMin = glm::min(boundsMin, glm::min(triangle.v0, glm::min(v1, v2)));
+	boundsMax = glm::max(boundsMax, glm::max(triangle.v0, glm::max(v1, v2)));
+}
+
+// slab test, returns the entry distance or FLT_MAX on a miss
+static float intersectBounds(BVHNode& node, glm::vec3& origin, glm::vec3& invDirection, float closest)
+{
+	float tx1 = (node.boundsMin.x - origin.x) * invDirection.x;
+	float tx2 = (node.boundsMax.x - origin.x) * invDirection.x;
+	float tmin = min(tx1, tx2);
+	float tmax = max(tx1, tx2);
+
+	float ty1 = (node.boundsMin.y - origin.y) * invDirection.y;
+	float ty2 = (node.boundsMax.y - origin.y) * invDirection.y;
+	tmin = max(tmin, min(ty1, ty2));
+	tmax = min(tmax, max(ty1, ty2));
+
+	float tz1 = (node.boundsMin.z - origin.z) * invDirection.z;
+	float tz2 = (node.boundsMax.z - origin.z) * invDirection.z;
+	tmin = max(tmin, min(tz1, tz2));
+	tmax = min(tmax, max(tz1, tz2));
+
+	if (tmax >= tmin && tmax > 0.0f && tmin < closest)
+		return tmin;
+	return FLT_MAX;
+}
+
+// Moller-Trumbore, double sided like the GPU kernel. Returns the distance or -1 on a miss
+static float intersectTriangle(BVHTriangle& triangle, glm::vec3& origin, glm::vec3& direction)
+{
+	glm::vec3 pvec = glm::cross(direction, triangle.edge2);
+	float det = glm::dot(triangle.edge1, pvec);
+
+	if (fabs(det) < 1e-8f)
+		return -1.0f;
+
+	float invDet = 1.0f / det;
+
+	glm::vec3 tvec = origin - triangle.v0;
+	float u = glm::dot(tvec, pvec) * invDet;
+	if (u < 0.0f || u > 1.0f)
+		return -1.0f;
+
+	glm::vec3 qvec = glm::cross(tvec, triangle.edge1);
+	float v = glm::dot(direction, qvec) * invDet;
+	if (v < 0.0f || (u + v) > 1.0f)
+		return -1.0f;
+
+	return glm::dot(triangle.edge2, qvec) * invDet;
+}
+
+static BVHTriangle makeTriangle(glm::vec3 a, glm::vec3 b, glm::vec3 c, int patchIndex)
+{
+	BVHTriangle triangle;
+	triangle.v0 = a;
+	triangle.edge1 = b - a;
+	triangle.edge2 = c - a;
+	triangle.patchIndex = patchIndex;
+	return triangle;
+}
+
+void BVH::clear()
+{
+	nodes.clear();
+	triangles.clear();
+	centroids.clear();
+	nodesUsed = 0;
+}
+
+void BVH::build(PatchTable& patches)
+{
+	clear();
+
+	for (int k = 0; k < patches.size(); k++)
+	{
+		if (patches.cornerCount[k] == 4)
+		{
+			triangles.push_back(makeTriangle(patches.a[k], patches.b[k], patches.d[k], k));
+			triangles.push_back(makeTriangle(patches.b[k], patches.c[k], patches.d[k], k));
+		}
+		else
+			triangles.push_back(makeTriangle(patches.a[k], patches.b[k], patches.c[k], k));
+	}
+
+	if (triangles.empty())
+		return;
+
+	centroids.resize(triangles.size());
+	for (int i = 0; i < triangles.size(); i++)
+		centroids[i] = triangles[i].v0 + (triangles[i].edge1 + triangles[i].edge2) / 3.0f;
+
+	// a binary tree with one triangle per leaf has at most 2N-1 nodes
+	nodes.resize(triangles.size() * 2);
+	nodesUsed = 1;
+
+	BVHNode& root = nodes[0];
+	root.leftFirst = 0;
+	root.count = triangles.size();
+
+	updateNodeBounds(0);
+	subdivide(0, 1);
+}
+
+void BVH::updateNodeBounds(int nodeIndex)
+{
+	BVHNode& node = nodes[nodeIndex];
+	node.boundsMin = glm::vec3(FLT_MAX);
+	node.boundsMax = glm::vec3(-FLT_MAX);
+
+	for (int i = node.leftFirst; i < node.leftFirst + node.count; i++)
+		growBounds(node.boundsMin, node.boundsMax, triangles[i]);
+}
+
+float BVH::findBestSplit(BVHNode& node, int& axis, float& splitPosition)
+{
+	struct Bin
+	{
+		glm::vec3 boundsMin;
+		glm::vec3 boundsMax;
+		int count;
+	};
+
+	float bestCost = FLT_MAX;
+
+	for (int a = 0; a < 3; a++)
+	{
+		float centroidMin = FLT_MAX;
+		float centroidMax = -FLT_MAX;
+		for (int i = node.leftFirst; i < node.leftFirst + node.count; i++)
+		{
+			centroidMin = min(centroidMin, centroids[i][a]);
+			centroidMax = max(centroidMax, centroids[i][a]);
+		}
+		if (centroidMin == centroidMax)
+			continue;
+
+		Bin bins[BVH_SAH_BINS];
+		for (int b = 0; b < BVH_SAH_BINS; b++)
+		{
+			bins[b].boundsMin = glm::vec3(FLT_MAX);
+			bins[b].boundsMax = glm::vec3(-FLT_MAX);
+			bins[b].count = 0;
+		}
+
+		float scale = BVH_SAH_BINS / (centroidMax - centroidMin);
+		for (int i = node.leftFirst; i < node.leftFirst + node.count; i++)
+		{
+			int b = min(BVH_SAH_BINS - 1, (int)((centroids[i][a] - centroidMin) * scale));
+			bins[b].count++;
+			growBounds(bins[b].boundsMin, bins[b].boundsMax, triangles[i]);
+		}
+
+		//sweep from both sides to get the area and count left and right of every plane
+		float leftArea[BVH_SAH_BINS - 1], rightArea[BVH_SAH_BINS - 1];
+		int leftCount[BVH_SAH_BINS - 1], rightCount[BVH_SAH_BINS - 1];
+
+		glm::vec3 leftMin(FLT_MAX), leftMax(-FLT_MAX);
+		glm::vec3 rightMin(FLT_MAX), rightMax(-FLT_MAX);
+		int leftSum = 0, rightSum = 0;
+
+		for (int b = 0; b < BVH_SAH_BINS - 1; b++)
+		{
+			leftSum += bins[b].count;
+			leftCount[b] = leftSum;
+			leftMin = glm::min(leftMin, bins[b].boundsMin);
+			leftMax = glm::max(leftMax, bins[b].boundsMax);
+			leftArea[b] = leftSum > 0 ? surfaceArea(leftMin, leftMax) : 0.0f;
+
+			rightSum += bins[BVH_SAH_BINS - 1 - b].count;
+			rightCount[BVH_SAH_BINS - 2 - b] = rightSum;
+			rightMin = glm::min(rightMin, bins[BVH_SAH_BINS - 1 - b].boundsMin);
+			rightMax = glm::max(rightMax, bins[BVH_SAH_BINS - 1 - b].boundsMax);
+			rightArea[BVH_SAH_BINS - 2 - b] = rightSum > 0 ? surfaceArea(rightMin, rightMax) : 0.0f;
+		}
+
+		for (int b = 0; b < BVH_SAH_BINS - 1; b++)
+		{
+			float cost = leftCount[b] * leftArea[b] + rightCount[b] * rightArea[b];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				axis = a;
+				splitPosition = centroidMin + (b + 1) / scale;
+			}
+		}
+	}
+	return bestCost;
+}
+
+void BVH::subdivide(int nodeIndex, int depth)
+{
+	BVHNode& node = nodes[nodeIndex];
+	if (node.count <= BVH_LEAF_SIZE || depth >= BVH_STACK_SIZE)
+		return;
+
+	int axis = 0;
+	float splitPosition = 0.0f;
+	float splitCost = findBestSplit(node, axis, splitPosition);
+	float leafCost = node.count * surfaceArea(node.boundsMin, node.boundsMax);
+	if (splitCost >= leafCost)
+		return;
+
+	//partition the triangles in place around the split plane
+	int i = node.leftFirst;
+	int j = node.leftFirst + node.count - 1;
+	while (i <= j)
+	{
+		if (centroids[i][axis] < splitPosition)
+			i++;
+		else
+		{
+			swap(triangles[i], triangles[j]);
+			swap(centroids[i], centroids[j]);
+			j--;
+		}
+	}
+
+	int leftCount = i - node.leftFirst;
+	if (leftCount == 0 || leftCount == node.count)
+		return;
+
+	int leftChild = nodesUsed++;
+	int rightChild = nodesUsed++;
+
+	nodes[leftChild].leftFirst = node.leftFirst;
+	nodes[leftChild].count = leftCount;
+	nodes[rightChild].leftFirst = i;
+	nodes[rightChild].count = node.count - leftCount;
+
+	node.leftFirst = leftChild;
+	node.count = 0;
+
+	updateNodeBounds(leftChild);
+	updateNodeBounds(rightChild);
+
+	subdivide(leftChild, depth + 1);
+	subdivide(rightChild, depth + 1);
+}
+
+bool BVH::intersect(Ray& ray, int& hitPatchIndex, float& hitDistance, glm::vec3& hitPoint)
+{
+	if (nodesUsed == 0)
+		return false;
+
+	glm::vec3 origin = ray.getStart();
+	glm::vec3 direction = ray.getDirection();
+	glm::vec3 invDirection;
+	for (int a = 0; a < 3; a++)
+	{
+		//avoid 0 * inf = NaN in the slab test for axis aligned rays
+		float d = fabs(direction[a]) > 1e-8f ? direction[a] : 1e-8f;
+		invDirection[a] = 1.0f / d;
+	}
+
+	float closest = FLT_MAX;
+	int closestPatch = -1;
+
+	if (intersectBounds(nodes[0], origin, invDirection, closest) == FLT_MAX)
+		return false;
+
+	int stack[BVH_STACK_SIZE];
+	int stackPtr = 0;
+	int nodeIndex = 0;
+
+	while (true)
+	{
+		BVHNode& node = nodes[nodeIndex];
+
+		if (node.count > 0) //leaf
+		{
+			for (int i = node.leftFirst; i < node.leftFirst + node.count; i++)
+			{
+				float t = intersectTriangle(triangles[i], origin, direction);
+				if (t > BVH_RAY_EPSILON && t < closest)
+				{
+					closest = t;
+					closestPatch = triangles[i].patchIndex;
+				}
+			}
+
+			if (stackPtr == 0)
+				break;
+			nodeIndex = stack[--stackPtr];
+			continue;
+		}
+
+		//visit the nearer child first, keep the other one for later
+		int child1 = node.leftFirst;
+		int child2 = node.leftFirst + 1;
+		float dist1 = intersectBounds(nodes[child1], origin, invDirection, closest);
+		float dist2 = intersectBounds(nodes[child2], origin, invDirection, closest);
+
+		if (dist1 > dist2)
+		{
+			swap(dist1, dist2);
+			swap(child1, child2);
+		}
+
+		if (dist1 == FLT_MAX)
+		{
+			if (stackPtr == 0)
+				break;
+			nodeIndex = stack[--stackPtr];
+		}
+		else
+		{
+			nodeIndex = child1;
+			if (dist2 != FLT_MAX)
+				stack[stackPtr++] = child2;
+		}
+	}
+
+	if (closestPatch == -1)
+		return false;
+
+	hitPatchIndex = closestPatch;
+	hitDistance = closest;
+	hitPoint = origin + closest * direction;
+	return true;
+}
@@ -0,0 +1,62 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "PatchTable.h"
+#include "Ray.h"
+
+#include <vector>
+
+#include <glm/vec3.hpp>
+#include <glm/glm.hpp>
+
+using namespace std;
+
+#define BVH_LEAF_SIZE		4
+#define BVH_SAH_BINS		12
+#define BVH_STACK_SIZE		64 // also bounds the depth of the tree
+#define BVH_RAY_EPSILON		0.001f // hits closer than this are treated as self intersections
+
+struct BVHNode
+{
+	glm::vec3 boundsMin;
+	int leftFirst; // index of the left child for inner nodes, index of the first triangle for leaves
+	glm::vec3 boundsMax;
+	int count; // 0 for inner nodes, number of triangles for leaves
+};
+
+struct BVHTriangle
+{
+	glm::vec3 v0;
+	glm::vec3 edge1;
+	glm::vec3 edge2;
+	int patchIndex; // index into the radiosity scene faces
+};
+
+// Bounding volume hierarchy over the radiosity patches. Quads are split into the
+// two triangles ABD and BCD, the same split used when sampling points on them.
+class BVH
+{
+public:
+	BVH() : nodesUsed(0) {}
+
+	void build(PatchTable& patches);
+	void clear();
+
+	// closest hit along the ray, returns false if nothing was hit
+	bool intersect(Ray& ray, int& hitPatchIndex, float& hitDistance, glm::vec3& hitPoint);
+
+	int getNodeCount() { return nodesUsed; }
+	int getTriangleCount() { return triangles.size(); }
+
+private:
+	void updateNodeBounds(int nodeIndex);
+	void subdivide(int nodeIndex, int depth);
+	float findBestSplit(BVHNode& node, int& axis, float& splitPosition);
+
+	vector<BVHNode> nodes;
+	vector<BVHTriangle> triangles;
+	vector<glm::vec3> centroids;
+	int nodesUsed;
+};
+
+#endif
@@ -0,0 +1,201 @@
+#include "FormFactorIO.h"
+#include "MappedFile.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fstream>
+#include <algorithm>
+
+unsigned long long hashBytes(const void* bytes, size_t count, unsigned long long hash)
+{
+	const unsigned char* current = (const unsigned char*)bytes;
+	for (size_t i = 0; i < count; i++)
+	{
+		hash ^= current[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+string formFactorCachePath(string directory, unsigned long long geometryHash)
+{
+	char name[32];
+	sprintf(name, "%016llx.ffc", geometryHash);
+
+	if (directory.empty())
+		return string(name);
+	if (directory.back() != '/' && directory.back() != '\\')
+		directory += '/';
+	return directory + name;
+}
+
+static void writeSparseSections(ofstream& fileStream, FormFactorMatrix& matrix)
+{
+	vector<unsigned int> rowOffsets(matrix.rowOffsets.begin(), matrix.rowOffsets.end());
+	vector<unsigned int> columns(matrix.columns.begin(), matrix.columns.end());
+	vector<float> values(matrix.values.begin(), matrix.values.end());
+
+	fileStream.write((const char*)rowOffsets.data(), rowOffsets.size() * sizeof(unsigned int));
+	fileStream.write((const char*)columns.data(), columns.size() * sizeof(unsigned int));
+	fileStream.write((const char*)values.data(), values.size() * sizeof(float));
+}
+
+static void readSparseSections(const char* data, unsigned int rowCount, unsigned int nonZeroCount, FormFactorMatrix& matrix)
+{
+	const unsigned int* rowOffsets = (const unsigned int*)data;
+	const unsigned int* columns = rowOffsets + rowCount + 1;
+	const float* values = (const float*)(columns + nonZeroCount);
+
+	matrix.rowOffsets.assign(rowOffsets, rowOffsets + rowCount + 1);
+	matrix.columns.assign(columns, columns + nonZeroCount);
+	matrix.values.assign(values, values + nonZeroCount);
+}
+
+bool loadFormFactorCache(string fileName, unsigned long long geometryHash, FormFactorMatrix& matrix)
+{
+	MappedFile file;
+	if (!file.open(fileName))
+		return false;
+
+	if (file.getSize() < sizeof(FormFactorCacheHeader))
+		return false;
+
+	const FormFactorCacheHeader* header = (const FormFactorCacheHeader*)file.getData();
+	if (memcmp(header->magic, "RFFC", 4) != 0 || header->version != FORM_FACTOR_CACHE_VERSION || header->geometryHash != geometryHash)
+		return false;
+
+	size_t expectedSize = sizeof(FormFactorCacheHeader) +
+		(header->rowCount + 1) * sizeof(unsigned int) +
+		header->nonZeroCount * (sizeof(unsigned int) + sizeof(float));
+	if (file.getSize() != expectedSize)
+	{
+		printf("Form factor cache %s is truncated, ignoring it\n", fileName.c_str());
+		return false;
+	}
+
+	readSparseSections((const char*)(header + 1), header->rowCount, header->nonZeroCount, matrix);
+	return true;
+}
+
+bool saveFormFactorCache(string fileName, unsigned long long geometryHash, FormFactorMatrix& matrix)
+{
+	if (matrix.rowOffsets.empty())
+		return false;
+
+	ofstream fileStream(fileName, ios::out | ios::binary);
+	if (!fileStream)
+	{
+		printf("Could not write form factor cache %s\n", fileName.c_str());
+		return false;
+	}
+
+	FormFactorCacheHeader header;
+	memcpy(header.magic, "RFFC", 4);
+	header.version = FORM_FACTOR_CACHE_VERSION;
+	header.geometryHash = geometryHash;
+	header.rowCount = matrix.getRowCount();
+	header.nonZeroCount = matrix.getNonZeroCount();
+	fileStream.write((const char*)&header, sizeof(header));
+	writeSparseSections(fileStream, matrix);
+
+	return fileStream.good();
+}
+
+bool exportFormFactors(string fileName, FormFactorMatrix& matrix, FormFactorExportFormat format)
+{
+	if (format == EXPORT_NONE || matrix.rowOffsets.empty())
+		return false;
+
+	ofstream fileStream(fileName, ios::out | ios::binary);
+	if (!fileStream)
+	{
+		printf("Could not write form factor export %s\n", fileName.c_str());
+		return false;
+	}
+
+	FormFactorExportHeader header;
+	memcpy(header.magic, "RFFM", 4);
+	header.version = FORM_FACTOR_EXPORT_VERSION;
+	header.format = format;
+	header.rowCount = matrix.getRowCount();
+	header.columnCount = matrix.getRowCount();
+	header.nonZeroCount = matrix.getNonZeroCount();
+	fileStream.write((const char*)&header, sizeof(header));
+
+	if (format == EXPORT_SPARSE)
+		writeSparseSections(fileStream, matrix);
+	else
+	{
+		// one row at a time, the full dense matrix never exists in memory
+		vector<float> denseRow(header.columnCount);
+		for (int i = 0; i < header.rowCount; i++)
+		{
+			fill(denseRow.begin(), denseRow.end(), 0.0f);
+			for (int k = matrix.rowOffsets[i]; k < matrix.rowOffsets[i + 1]; k++)
+				denseRow[matrix.columns[k]] = (float)matrix.values[k];
+			fileStream.write((const char*)denseRow.data(), denseRow.size() * sizeof(float));
+		}
+	}
+
+	return fileStream.good();
+}
+
+bool importFormFactors(string fileName, FormFactorMatrix& matrix)
+{
+	MappedFile file;
+	if (!file.open(fileName))
+	{
+		printf("Could not open form factor export %s\n", fileName.c_str());
+		return false;
+	}
+
+	const FormFactorExportHeader* header = (const FormFactorExportHeader*)file.getData();
+	if (file.getSize() < sizeof(FormFactorExportHeader) || memcmp(header->magic, "RFFM", 4) != 0 || header->version != FORM_FACTOR_EXPORT_VERSION)
+	{
+		printf("%s is not a form factor export\n", fileName.c_str());
+		return false;
+	}
+
+	const char* sections = (const char*)(header + 1);
+	size_t sectionSize = file.getSize() - sizeof(FormFactorExportHeader);
+
+	if (header->format == EXPORT_SPARSE)
+	{
+		if (sectionSize != (header->rowCount + 1) * sizeof(unsigned int) + header->nonZeroCount * (sizeof(unsigned int) + sizeof(float)))
+		{
+			printf("%s is truncated\n", fileName.c_str());
+			return false;
+		}
+		readSparseSections(sections, header->rowCount, header->nonZeroCount, matrix);
+		return true;
+	}
+
+	if (header->format == EXPORT_DENSE)
+	{
+		if (sectionSize != (size_t)header->rowCount * header->columnCount * sizeof(float))
+		{
+			printf("%s is truncated\n", fileName.c_str());
+			return false;
+		}
+
+		const float* values = (const float*)sections;
+		vector<FormFactorRow> rows(header->rowCount);
+		for (int i = 0; i < header->rowCount; i++)
+		{
+			for (int j = 0; j < header->columnCount; j++)
+			{
+				float value = values[(size_t)i * header->columnCount + j];
+				if (value != 0.0f)
+				{
+					rows[i].columns.push_back(j);
+					rows[i].values.push_back(value);
+				}
+			}
+		}
+		matrix.build(rows);
+		return true;
+	}
+
+	printf("%s has an unknown layout %u\n", fileName.c_str(), header->format);
+	return false;
+}
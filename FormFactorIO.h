@@ -0,0 +1,52 @@
+#ifndef FORM_FACTOR_IO_H
+#define FORM_FACTOR_IO_H
+
+#include "FormFactorMatrix.h"
+#include "RadiosityOptions.h"
+
+#include <string>
+
+using namespace std;
+
+#define FORM_FACTOR_CACHE_VERSION	2 // 2: directions sampled in an orthonormal patch frame
+#define FORM_FACTOR_EXPORT_VERSION	1
+
+// Cache file layout, every section is 4 byte aligned so the file can be used straight from a mapping:
+//   FormFactorCacheHeader
+//   unsigned int rowOffsets[rowCount + 1]
+//   unsigned int columns[nonZeroCount]
+//   float values[nonZeroCount]
+struct FormFactorCacheHeader
+{
+	char magic[4]; // "RFFC"
+	unsigned int version;
+	unsigned long long geometryHash;
+	unsigned int rowCount;
+	unsigned int nonZeroCount;
+};
+
+// Export file layout, meant for comparing matrices between runs:
+//   FormFactorExportHeader
+//   dense:  float values[rowCount * columnCount]
+//   sparse: unsigned int rowOffsets[rowCount + 1], unsigned int columns[nonZeroCount], float values[nonZeroCount]
+struct FormFactorExportHeader
+{
+	char magic[4]; // "RFFM"
+	unsigned int version;
+	unsigned int format; // FormFactorExportFormat
+	unsigned int rowCount;
+	unsigned int columnCount;
+	unsigned int nonZeroCount;
+};
+
+// 64 bit FNV-1a, used to key cache files on the patch geometry
+unsigned long long hashBytes(const void* bytes, size_t count, unsigned long long hash = 14695981039346656037ULL);
+
+string formFactorCachePath(string directory, unsigned long long geometryHash);
+bool loadFormFactorCache(string fileName, unsigned long long geometryHash, FormFactorMatrix& matrix);
+bool saveFormFactorCache(string fileName, unsigned long long geometryHash, FormFactorMatrix& matrix);
+
+bool exportFormFactors(string fileName, FormFactorMatrix& matrix, FormFactorExportFormat format);
+bool importFormFactors(string fileName, FormFactorMatrix& matrix); // reads either export layout
+
+#endif
@@ -0,0 +1,134 @@
+#include "FormFactorMatrix.h"
+
+#include <algorithm>
+
+void FormFactorRow::buildFromHits(int* hits, int hitCount, double weight)
+{
+	clear();
+
+	vector<int> sortedHits(hits, hits + hitCount);
+	sort(sortedHits.begin(), sortedHits.end());
+
+	for (int k = 0; k < sortedHits.size(); k++)
+	{
+		if (sortedHits[k] < 0)
+			continue;
+
+		if (!columns.empty() && columns.back() == sortedHits[k])
+			values.back() += weight;
+		else
+		{
+			columns.push_back(sortedHits[k]);
+			values.push_back(weight);
+		}
+	}
+}
+
+void FormFactorMatrix::clear()
+{
+	rowOffsets.clear();
+	columns.clear();
+	values.clear();
+}
+
+void FormFactorMatrix::build(vector<FormFactorRow>& rows)
+{
+	clear();
+
+	rowOffsets.resize(rows.size() + 1);
+	rowOffsets[0] = 0;
+	for (int i = 0; i < rows.size(); i++)
+		rowOffsets[i + 1] = rowOffsets[i] + rows[i].columns.size();
+
+	columns.resize(rowOffsets.back());
+	values.resize(rowOffsets.back());
+	for (int i = 0; i < rows.size(); i++)
+	{
+		copy(rows[i].columns.begin(), rows[i].columns.end(), columns.begin() + rowOffsets[i]);
+		copy(rows[i].values.begin(), rows[i].values.end(), values.begin() + rowOffsets[i]);
+	}
+}
+
+void FormFactorMatrix::combineReciprocal(vector<float>& areas, vector<int>& rayCounts)
+{
+	int rowCount = getRowCount();
+
+	// transpose: row j of transposeColumns/Values holds the F_ij of every shooter i that hit j
+	vector<int> transposeOffsets(rowCount + 1, 0);
+	for (int k = 0; k < columns.size(); k++)
+		transposeOffsets[columns[k] + 1]++;
+	for (int j = 0; j < rowCount; j++)
+		transposeOffsets[j + 1] += transposeOffsets[j];
+
+	vector<int> transposeColumns(columns.size());
+	vector<double> transposeValues(values.size());
+	vector<int> cursor(transposeOffsets.begin(), transposeOffsets.end() - 1);
+	for (int i = 0; i < rowCount; i++)
+	{
+		// rows are visited in order, so every transposed row comes out sorted
+		for (int k = rowOffsets[i]; k < rowOffsets[i + 1]; k++)
+		{
+			int slot = cursor[columns[k]]++;
+			transposeColumns[slot] = i;
+			transposeValues[slot] = values[k];
+		}
+	}
+
+	// merge row i (F_ij) with transposed row i (F_ji), both sorted by j
+	vector<FormFactorRow> rows(rowCount);
+	for (int i = 0; i < rowCount; i++)
+	{
+		int k = rowOffsets[i], kEnd = rowOffsets[i + 1];
+		int t = transposeOffsets[i], tEnd = transposeOffsets[i + 1];
+		while (k < kEnd || t < tEnd)
+		{
+			int j;
+			double F_ij = 0.0, F_ji = 0.0;
+			if (t == tEnd || (k < kEnd && columns[k] < transposeColumns[t]))
+				j = columns[k], F_ij = values[k++];
+			else if (k == kEnd || transposeColumns[t] < columns[k])
+				j = transposeColumns[t], F_ji = transposeValues[t++];
+			else
+				j = columns[k], F_ij = values[k++], F_ji = transposeValues[t++];
+
+			// a degenerate patch on either side gives nothing to combine with
+			double F = F_ij;
+			if (areas[i] > 0.0f && areas[j] > 0.0f && rayCounts[i] + rayCounts[j] > 0)
+			{
+				double weights = rayCounts[i] / (double)areas[i] + rayCounts[j] / (double)areas[j];
+				F = (rayCounts[i] * F_ij + rayCounts[j] * F_ji) / (weights * areas[i]);
+			}
+
+			if (F > 0.0)
+			{
+				rows[i].columns.push_back(j);
+				rows[i].values.push_back(F);
+			}
+		}
+	}
+
+	build(rows);
+}
+
+double FormFactorMatrix::get(int i, int j)
+{
+	vector<int>::iterator begin = columns.begin() + rowOffsets[i];
+	vector<int>::iterator end = columns.begin() + rowOffsets[i + 1];
+	vector<int>::iterator found = lower_bound(begin, end, j);
+
+	if (found != end && *found == j)
+		return values[found - columns.begin()];
+	return 0.0;
+}
+
+Eigen::MatrixXd FormFactorMatrix::toDense()
+{
+	int rowCount = getRowCount();
+	Eigen::MatrixXd dense = Eigen::MatrixXd::Zero(rowCount, rowCount);
+
+	for (int i = 0; i < rowCount; i++)
+		for (int k = rowOffsets[i]; k < rowOffsets[i + 1]; k++)
+			dense(i, columns[k]) = values[k];
+
+	return dense;
+}
@@ -0,0 +1,44 @@
+#ifndef FORM_FACTOR_MATRIX_H
+#define FORM_FACTOR_MATRIX_H
+
+#include <vector>
+#include <Eigen/Dense>
+
+using namespace std;
+
+// One row of form factors F_ij for a fixed shooter i, sorted by column
+struct FormFactorRow
+{
+	vector<int> columns;
+	vector<double> values;
+
+	// turns a list of hit patch indexes (-1 for a miss) into sorted (column, weight * hits) pairs
+	void buildFromHits(int* hits, int hitCount, double weight);
+	void clear() { columns.clear(); values.clear(); }
+};
+
+// Form factors stored in compressed sparse row layout. Every row has at most
+// as many nonzeros as rays were shot from its patch.
+struct FormFactorMatrix
+{
+	vector<int> rowOffsets; // row i occupies [rowOffsets[i], rowOffsets[i+1])
+	vector<int> columns;
+	vector<double> values;
+
+	void clear();
+	void build(vector<FormFactorRow>& rows);
+
+	// Reciprocity: A_i F_ij = A_j F_ji, so both rows estimate the same pair. A_i F_ij from n_i
+	// rays has variance about A_i * A_i F_ij / n_i, the inverse variance weighted mean of the two
+	// sides is (n_i F_ij + n_j F_ji) / (n_i / A_i + n_j / A_j), the hit counts over the weights.
+	// Every pair either side hit gets this value on both sides, the pattern becomes symmetric.
+	void combineReciprocal(vector<float>& areas, vector<int>& rayCounts);
+
+	int getRowCount() { return rowOffsets.empty() ? 0 : rowOffsets.size() - 1; }
+	int getNonZeroCount() { return values.size(); }
+	double get(int i, int j);
+
+	Eigen::MatrixXd toDense();
+};
+
+#endif
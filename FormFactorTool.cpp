@@ -0,0 +1,149 @@
+// Standalone reader for form factor exports written with -ffexport.
+// Build it on its own with FormFactorIO.cpp, FormFactorMatrix.cpp and MappedFile.cpp.
+//
+//   FormFactorTool info <file>              prints the size, row sums and sparsity
+//   FormFactorTool diff <file> <file>       compares two exports entry by entry
+//   FormFactorTool csv <file> <out.csv>     writes the dense matrix as text
+
+#include "FormFactorIO.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static void printInfo(FormFactorMatrix& matrix)
+{
+	int rowCount = matrix.getRowCount();
+	double minRowSum = rowCount > 0 ? 1e30 : 0.0;
+	double maxRowSum = 0.0;
+	double totalRowSum = 0.0;
+
+	for (int i = 0; i < rowCount; i++)
+	{
+		double rowSum = 0.0;
+		for (int k = matrix.rowOffsets[i]; k < matrix.rowOffsets[i + 1]; k++)
+			rowSum += matrix.values[k];
+
+		minRowSum = min(minRowSum, rowSum);
+		maxRowSum = max(maxRowSum, rowSum);
+		totalRowSum += rowSum;
+	}
+
+	double fill = rowCount > 0 ? (double)matrix.getNonZeroCount() / ((double)rowCount * rowCount) : 0.0;
+	printf("patches: %d\n", rowCount);
+	printf("nonzeros: %d (%.2f%% filled)\n", matrix.getNonZeroCount(), fill * 100.0);
+	printf("row sums: min %f max %f mean %f\n", minRowSum, maxRowSum, rowCount > 0 ? totalRowSum / rowCount : 0.0);
+}
+
+static int printDiff(FormFactorMatrix& a, FormFactorMatrix& b)
+{
+	if (a.getRowCount() != b.getRowCount())
+	{
+		printf("patch counts differ: %d vs %d\n", a.getRowCount(), b.getRowCount());
+		return 1;
+	}
+
+	int rowCount = a.getRowCount();
+	vector<double> denseRow(rowCount);
+	double maxDifference = 0.0;
+	double sumSquared = 0.0;
+	int maxRow = -1, maxColumn = -1;
+	int differingEntries = 0;
+
+	for (int i = 0; i < rowCount; i++)
+	{
+		fill(denseRow.begin(), denseRow.end(), 0.0);
+		for (int k = a.rowOffsets[i]; k < a.rowOffsets[i + 1]; k++)
+			denseRow[a.columns[k]] = a.values[k];
+		for (int k = b.rowOffsets[i]; k < b.rowOffsets[i + 1]; k++)
+			denseRow[b.columns[k]] -= b.values[k];
+
+		for (int j = 0; j < rowCount; j++)
+		{
+			double difference = fabs(denseRow[j]);
+			if (difference == 0.0)
+				continue;
+
+			differingEntries++;
+			sumSquared += difference * difference;
+			if (difference > maxDifference)
+			{
+				maxDifference = difference;
+				maxRow = i;
+				maxColumn = j;
+			}
+		}
+	}
+
+	printf("differing entries: %d\n", differingEntries);
+	printf("frobenius norm of the difference: %f\n", sqrt(sumSquared));
+	if (maxRow >= 0)
+		printf("largest difference: %f at (%d, %d)\n", maxDifference, maxRow, maxColumn);
+	return differingEntries > 0 ? 1 : 0;
+}
+
+static bool writeCsv(FormFactorMatrix& matrix, string fileName)
+{
+	ofstream file(fileName);
+	if (!file.is_open())
+		return false;
+
+	int rowCount = matrix.getRowCount();
+	vector<double> denseRow(rowCount);
+	for (int i = 0; i < rowCount; i++)
+	{
+		fill(denseRow.begin(), denseRow.end(), 0.0);
+		for (int k = matrix.rowOffsets[i]; k < matrix.rowOffsets[i + 1]; k++)
+			denseRow[matrix.columns[k]] = matrix.values[k];
+
+		for (int j = 0; j < rowCount; j++)
+		{
+			file << to_string(denseRow[j]);
+			file << (j + 1 == rowCount ? '\n' : ',');
+		}
+	}
+	return file.good();
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc == 3 && !strcmp(argv[1], "info"))
+	{
+		FormFactorMatrix matrix;
+		if (!importFormFactors(argv[2], matrix))
+			return 1;
+		printInfo(matrix);
+		return 0;
+	}
+
+	if (argc == 4 && !strcmp(argv[1], "diff"))
+	{
+		FormFactorMatrix a, b;
+		if (!importFormFactors(argv[2], a) || !importFormFactors(argv[3], b))
+			return 1;
+		return printDiff(a, b);
+	}
+
+	if (argc == 4 && !strcmp(argv[1], "csv"))
+	{
+		FormFactorMatrix matrix;
+		if (!importFormFactors(argv[2], matrix))
+			return 1;
+		if (!writeCsv(matrix, argv[3]))
+		{
+			printf("Could not write %s\n", argv[3]);
+			return 1;
+		}
+		return 0;
+	}
+
+	printf("usage: FormFactorTool info <file>\n");
+	printf("       FormFactorTool diff <file> <file>\n");
+	printf("       FormFactorTool csv <file> <out.csv>\n");
+	return 1;
+}
@@ -0,0 +1,27 @@
+#ifndef HEMISPHERE_SAMPLING_H
+#define HEMISPHERE_SAMPLING_H
+
+#include <math.h>
+
+// Included by the CPU code with glm::vec3 and by RayShoot.cu / RayShootCPU.cpp with
+// optix::float3, so every form factor backend draws its directions the same way.
+#ifdef __CUDACC__
+#define HEMISPHERE_CALLABLE __host__ __device__
+#else
+#define HEMISPHERE_CALLABLE
+#endif
+
+// Cosine weighted direction around normal from two uniform numbers in [0,1) (Malley's method:
+// uniform on the disk, projected up to the hemisphere). tangent, bitangent and normal must be
+// an orthonormal frame, like the one PatchTable::build stores per patch, the result is then
+// unit length.
+template <class Vector>
+HEMISPHERE_CALLABLE inline Vector cosineWeightedDirection(float u, float v, const Vector& tangent, const Vector& bitangent, const Vector& normal)
+{
+	float sin_theta = sqrtf(u);
+	float cos_theta = sqrtf(1.0f - u);
+	float psi = v * 2.0f * 3.14159265359f;
+	return (sin_theta * cosf(psi)) * tangent + (sin_theta * sinf(psi)) * bitangent + cos_theta * normal;
+}
+
+#endif
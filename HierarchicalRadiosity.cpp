@@ -0,0 +1,429 @@
+#include "HierarchicalRadiosity.h"
+
+#include <float.h>
+#include <algorithm>
+
+static float polygonArea(glm::vec3* corners, int cornerCount)
+{
+	float area = 0.5f * glm::length(glm::cross(corners[1] - corners[0], corners[2] - corners[0]));
+	if (cornerCount == 4)
+		area += 0.5f * glm::length(glm::cross(corners[2] - corners[0], corners[3] - corners[0]));
+	return area;
+}
+
+// smallest barycentric coordinate of point projected onto the triangle, positive inside
+static float triangleContainment(glm::vec3 a, glm::vec3 b, glm::vec3 c, glm::vec3 point)
+{
+	glm::vec3 e0 = b - a, e1 = c - a, p = point - a;
+	float d00 = glm::dot(e0, e0), d01 = glm::dot(e0, e1), d11 = glm::dot(e1, e1);
+	float d20 = glm::dot(p, e0), d21 = glm::dot(p, e1);
+	float denominator = d00 * d11 - d01 * d01;
+	if (denominator <= 0.0f)
+		return -FLT_MAX;
+
+	float v = (d11 * d20 - d01 * d21) / denominator;
+	float w = (d00 * d21 - d01 * d20) / denominator;
+	return min(1.0f - v - w, min(v, w));
+}
+
+// quads are tested as ABD and BCD like everywhere else
+static float polygonContainment(glm::vec3* corners, int cornerCount, glm::vec3 point)
+{
+	if (cornerCount == 4)
+		return max(triangleContainment(corners[0], corners[1], corners[3], point), triangleContainment(corners[1], corners[2], corners[3], point));
+	return triangleContainment(corners[0], corners[1], corners[2], point);
+}
+
+// the input face patch i was cut from: facing the same way, in its plane and holding the patch centroid
+// best of all. -1 if the patch lies on no input face
+static int findRoot(PatchTable& roots, PatchTable& patches, int i)
+{
+	int best = -1;
+	float bestContainment = -FLT_MAX;
+	for (int r = 0; r < roots.size(); r++)
+	{
+		if (glm::dot(roots.normal[r], patches.normal[i]) <= 0.0f)
+			continue;
+		float planeDistance = fabs(glm::dot(roots.normal[r], patches.centroid[i] - roots.centroid[r]));
+		if (planeDistance > HIERARCHICAL_PLANE_TOLERANCE * glm::sqrt(roots.area[r]))
+			continue;
+
+		glm::vec3 corners[4] = { roots.a[r], roots.b[r], roots.c[r], roots.d[r] };
+		float containment = polygonContainment(corners, roots.cornerCount[r], patches.centroid[i]);
+		if (containment > bestContainment)
+		{
+			best = r;
+			bestContainment = containment;
+		}
+	}
+	return best;
+}
+
+void HierarchicalRadiosity::clear()
+{
+	nodes.clear();
+	links.clear();
+	linkOffsets.clear();
+	radiosity.clear();
+	gathered.clear();
+	patchNodes.clear();
+	rootCount = 0;
+}
+
+int HierarchicalRadiosity::getLeafCount()
+{
+	int leaves = 0;
+	for (int i = 0; i < nodes.size(); i++)
+		leaves += nodes[i].firstChild == -1;
+	return leaves;
+}
+
+int HierarchicalRadiosity::addNode(glm::vec3* corners, int cornerCount, glm::vec3 normal, int patch)
+{
+	HierarchyNode node;
+	node.cornerCount = cornerCount;
+	node.centroid = glm::vec3(0.0f);
+	for (int k = 0; k < cornerCount; k++)
+	{
+		node.corners[k] = corners[k];
+		node.centroid += corners[k];
+	}
+	node.centroid /= (float)cornerCount;
+	node.corners[3] = corners[cornerCount - 1];
+	node.normal = normal;
+	node.area = polygonArea(corners, cornerCount);
+	node.patch = patch;
+	node.firstChild = -1;
+	node.childCount = 0;
+
+	nodes.push_back(node);
+	return nodes.size() - 1;
+}
+
+// returns false if the node is too small to split, the children may already exist
+bool HierarchicalRadiosity::split(int index)
+{
+	if (nodes[index].firstChild != -1)
+		return true;
+	if (nodes[index].area < minArea)
+		return false;
+
+	// copied, addNode can move the node storage
+	HierarchyNode node = nodes[index];
+	glm::vec3* c = node.corners;
+	int firstChild = nodes.size();
+
+	if (node.cornerCount == 3)
+	{
+		// bisect the longest edge, both halves keep the winding of the parent
+		int e = 0;
+		float longest = 0.0f;
+		for (int k = 0; k < 3; k++)
+		{
+			float length = glm::length(c[(k + 1) % 3] - c[k]);
+			if (length > longest)
+			{
+				longest = length;
+				e = k;
+			}
+		}
+
+		glm::vec3 a = c[e], b = c[(e + 1) % 3], opposite = c[(e + 2) % 3];
+		glm::vec3 midpoint = (a + b) / 2.0f;
+
+		glm::vec3 first[3] = { a, midpoint, opposite };
+		glm::vec3 second[3] = { midpoint, b, opposite };
+		addNode(first, 3, node.normal, node.patch);
+		addNode(second, 3, node.normal, node.patch);
+	}
+	else
+	{
+		glm::vec3 ab = (c[0] + c[1]) / 2.0f;
+		glm::vec3 bc = (c[1] + c[2]) / 2.0f;
+		glm::vec3 cd = (c[2] + c[3]) / 2.0f;
+		glm::vec3 da = (c[3] + c[0]) / 2.0f;
+		glm::vec3 center = node.centroid;
+
+		glm::vec3 quad_a[4] = { c[0], ab, center, da };
+		glm::vec3 quad_b[4] = { ab, c[1], bc, center };
+		glm::vec3 quad_c[4] = { center, bc, c[2], cd };
+		glm::vec3 quad_d[4] = { da, center, cd, c[3] };
+		addNode(quad_a, 4, node.normal, node.patch);
+		addNode(quad_b, 4, node.normal, node.patch);
+		addNode(quad_c, 4, node.normal, node.patch);
+		addNode(quad_d, 4, node.normal, node.patch);
+	}
+
+	nodes[index].firstChild = firstChild;
+	nodes[index].childCount = nodes.size() - firstChild;
+	return true;
+}
+
+// Unoccluded F_receiver,source from the receiver centroid to a disk with the area of the source.
+// Returns -1 when one node lies completely behind the other. needsSplit is set when the nodes
+// partly face each other but their centroids do not, the estimate means nothing then.
+double HierarchicalRadiosity::estimateFormFactor(int receiver, int source, bool& needsSplit)
+{
+	HierarchyNode& r = nodes[receiver];
+	HierarchyNode& s = nodes[source];
+
+	bool sourceInFront = false;
+	bool receiverInFront = false;
+	for (int k = 0; k < s.cornerCount; k++)
+		sourceInFront |= glm::dot(r.normal, s.corners[k] - r.centroid) > 0.0f;
+	for (int k = 0; k < r.cornerCount; k++)
+		receiverInFront |= glm::dot(s.normal, r.corners[k] - s.centroid) > 0.0f;
+	if (!sourceInFront || !receiverInFront)
+		return -1.0;
+
+	glm::vec3 direction = s.centroid - r.centroid;
+	float distanceSquared = glm::dot(direction, direction);
+	float distance = glm::sqrt(distanceSquared);
+	float cos_r = distance > 0.0f ? glm::dot(r.normal, direction) / distance : 0.0f;
+	float cos_s = distance > 0.0f ? -glm::dot(s.normal, direction) / distance : 0.0f;
+	if (cos_r <= 0.0f || cos_s <= 0.0f)
+	{
+		needsSplit = true;
+		return 0.0;
+	}
+
+	return (double)(cos_r * cos_s * s.area) / (3.14159265359 * distanceSquared + s.area);
+}
+
+// Same disk estimate averaged over every receiver corner / source corner pair, for nodes whose
+// centroids do not face each other. Pairs behind either plane add nothing, but the corner of each
+// node that lies in front of the other is in front along the segment between them too, so nodes
+// that estimateFormFactor did not reject always get a nonzero value.
+double HierarchicalRadiosity::estimateCornerFormFactor(int receiver, int source)
+{
+	HierarchyNode& r = nodes[receiver];
+	HierarchyNode& s = nodes[source];
+
+	double sum = 0.0;
+	for (int i = 0; i < r.cornerCount; i++)
+	{
+		for (int j = 0; j < s.cornerCount; j++)
+		{
+			glm::vec3 direction = s.corners[j] - r.corners[i];
+			float distanceSquared = glm::dot(direction, direction);
+			if (distanceSquared <= 0.0f)
+				continue;
+
+			float distance = glm::sqrt(distanceSquared);
+			float cos_r = glm::max(glm::dot(r.normal, direction) / distance, 0.0f);
+			float cos_s = glm::max(-glm::dot(s.normal, direction) / distance, 0.0f);
+			sum += (double)(cos_r * cos_s * s.area) / (3.14159265359 * distanceSquared + s.area);
+		}
+	}
+	return sum / (r.cornerCount * s.cornerCount);
+}
+
+void HierarchicalRadiosity::refine(int receiver, int source)
+{
+	bool needsSplit = false;
+	double F_rs = estimateFormFactor(receiver, source, needsSplit);
+	if (F_rs < 0.0)
+		return;
+	double F_sr = estimateFormFactor(source, receiver, needsSplit);
+
+	if (needsSplit || F_rs > HIERARCHICAL_FORM_FACTOR_EPSILON || F_sr > HIERARCHICAL_FORM_FACTOR_EPSILON)
+	{
+		// split whichever node looks larger from the other one, fall back to the other if it is too small
+		bool splitSource = F_rs >= F_sr;
+		for (int attempt = 0; attempt < 2; attempt++, splitSource = !splitSource)
+		{
+			int node = splitSource ? source : receiver;
+			if (!split(node))
+				continue;
+
+			int firstChild = nodes[node].firstChild;
+			int childCount = nodes[node].childCount;
+			for (int c = firstChild; c < firstChild + childCount; c++)
+			{
+				if (splitSource)
+					refine(receiver, c);
+				else
+					refine(c, source);
+			}
+			return;
+		}
+	}
+
+	// both nodes are too small to split, the centroid estimate is useless for them
+	if (needsSplit)
+		F_rs = estimateCornerFormFactor(receiver, source);
+
+	if (F_rs > 0.0)
+	{
+		HierarchyLink link;
+		link.receiver = receiver;
+		link.source = source;
+		link.formFactor = F_rs;
+		links.push_back(link);
+	}
+}
+
+glm::vec3 HierarchicalRadiosity::samplePoint(HierarchyNode& node, mt19937& generator)
+{
+	// same mapping as PatchTable::samplePoint, quads pick ABD or BCD by area
+	uniform_real_distribution<double> uniform(0.0, 1.0);
+	glm::vec3 a = node.corners[0], b = node.corners[1], c = node.corners[2];
+	if (node.cornerCount == 4)
+	{
+		float area_abd = 0.5f * glm::length(glm::cross(b - a, node.corners[3] - a));
+		if (uniform(generator) * node.area < area_abd)
+			c = node.corners[3];
+		else
+		{
+			a = node.corners[1];
+			b = node.corners[2];
+			c = node.corners[3];
+		}
+	}
+
+	double r1 = glm::sqrt(uniform(generator));
+	double r2 = uniform(generator);
+	return (float)(1.0 - r1) * a + (float)(r1 * (1.0 - r2)) * b + (float)(r2 * r1) * c;
+}
+
+double HierarchicalRadiosity::estimateVisibility(HierarchyLink& link, UniformGrid& grid, mt19937& generator)
+{
+	HierarchyNode& receiver = nodes[link.receiver];
+	HierarchyNode& source = nodes[link.source];
+
+	int visible = 0;
+	for (int k = 0; k < HIERARCHICAL_VISIBILITY_SAMPLES; k++)
+	{
+		glm::vec3 from = samplePoint(receiver, generator);
+		glm::vec3 to = samplePoint(source, generator);
+		if (!grid.isOccluded(from, to, receiver.patch, source.patch))
+			visible++;
+	}
+	return (double)visible / HIERARCHICAL_VISIBILITY_SAMPLES;
+}
+
+// descends towards the patch centroid until a node is no larger than the patch
+int HierarchicalRadiosity::findPatchNode(int index, glm::vec3 centroid, float area)
+{
+	while (nodes[index].firstChild != -1 && nodes[index].area > area * HIERARCHICAL_AREA_TOLERANCE)
+	{
+		int firstChild = nodes[index].firstChild;
+		int best = firstChild;
+		float bestContainment = -FLT_MAX;
+		for (int c = firstChild; c < firstChild + nodes[index].childCount; c++)
+		{
+			float containment = polygonContainment(nodes[c].corners, nodes[c].cornerCount, centroid);
+			if (containment > bestContainment)
+			{
+				best = c;
+				bestContainment = containment;
+			}
+		}
+		index = best;
+	}
+	return index;
+}
+
+void HierarchicalRadiosity::build(PatchTable& roots, PatchTable& patches, UniformGrid& grid, ThreadPool& pool, vector<mt19937>& generators)
+{
+	clear();
+
+	int patchCount = patches.size();
+	vector<int> patchRoots(patchCount);
+	pool.parallelFor(patchCount, [&](int i, int) {
+		patchRoots[i] = findRoot(roots, patches, i);
+	});
+
+	// input faces holding at least one patch become roots, a patch that lies on none is a root of its own
+	vector<int> rootNodes(roots.size(), -1);
+	patchNodes.assign(patchCount, -1);
+	float largestArea = 0.0f;
+	for (int i = 0; i < patchCount; i++)
+	{
+		int r = patchRoots[i];
+		if (r == -1)
+		{
+			glm::vec3 corners[4] = { patches.a[i], patches.b[i], patches.c[i], patches.d[i] };
+			patchNodes[i] = addNode(corners, patches.cornerCount[i], patches.normal[i], i);
+		}
+		else if (rootNodes[r] == -1)
+		{
+			glm::vec3 corners[4] = { roots.a[r], roots.b[r], roots.c[r], roots.d[r] };
+			rootNodes[r] = addNode(corners, roots.cornerCount[r], roots.normal[r], i);
+		}
+		largestArea = max(largestArea, patches.area[i]);
+	}
+	rootCount = nodes.size();
+
+	// the patches set the finest level, the roots only where it starts
+	minArea = largestArea * HIERARCHICAL_MIN_AREA_FRACTION;
+
+	// planar patches never see themselves, every other ordered pair starts at the roots
+	for (int receiver = 0; receiver < rootCount; receiver++)
+		for (int source = 0; source < rootCount; source++)
+			if (receiver != source)
+				refine(receiver, source);
+
+	// refinement only looks at unoccluded estimates, the rays are the expensive part
+	pool.parallelFor(links.size(), [&](int k, int threadIndex) {
+		links[k].formFactor *= estimateVisibility(links[k], grid, generators[threadIndex]);
+	});
+
+	links.erase(remove_if(links.begin(), links.end(), [](HierarchyLink& link) { return link.formFactor <= 0.0; }), links.end());
+	stable_sort(links.begin(), links.end(), [](const HierarchyLink& x, const HierarchyLink& y) { return x.receiver < y.receiver; });
+
+	linkOffsets.assign(nodes.size() + 1, 0);
+	for (int k = 0; k < links.size(); k++)
+		linkOffsets[links[k].receiver + 1]++;
+	for (int i = 0; i < nodes.size(); i++)
+		linkOffsets[i + 1] += linkOffsets[i];
+
+	radiosity.assign(nodes.size(), glm::dvec3(0.0));
+	gathered.assign(nodes.size(), glm::dvec3(0.0));
+
+	for (int i = 0; i < patchCount; i++)
+		if (patchRoots[i] != -1)
+			patchNodes[i] = findPatchNode(rootNodes[patchRoots[i]], patches.centroid[i], patches.area[i]);
+}
+
+// pushes the radiosity gathered above down to the leaves and returns the area weighted average back up
+glm::dvec3 HierarchicalRadiosity::pushPull(int index, glm::dvec3 down, vector<glm::dvec3>& emission)
+{
+	HierarchyNode& node = nodes[index];
+	down += gathered[index];
+
+	glm::dvec3 up(0.0);
+	if (node.firstChild == -1)
+		up = emission[node.patch] + down;
+	else
+	{
+		for (int c = node.firstChild; c < node.firstChild + node.childCount; c++)
+			up += pushPull(c, down, emission) * (double)(nodes[c].area / node.area);
+	}
+
+	radiosity[index] = up;
+	return up;
+}
+
+glm::dvec3 HierarchicalRadiosity::iterate(vector<glm::dvec3>& emission, vector<glm::dvec3>& reflectance, ThreadPool& pool)
+{
+	// Jacobi style: every link gathers from the radiosity of the previous push-pull
+	pool.parallelFor(nodes.size(), [&](int i, int) {
+		glm::dvec3 sum(0.0);
+		for (int k = linkOffsets[i]; k < linkOffsets[i + 1]; k++)
+			sum += links[k].formFactor * radiosity[links[k].source];
+		gathered[i] = reflectance[nodes[i].patch] * sum;
+	});
+
+	vector<glm::dvec3> previous(radiosity.begin(), radiosity.begin() + rootCount);
+
+	// the trees are disjoint, so roots can be pushed and pulled concurrently
+	pool.parallelFor(rootCount, [&](int root, int) {
+		pushPull(root, glm::dvec3(0.0), emission);
+	});
+
+	glm::dvec3 change(0.0);
+	for (int i = 0; i < rootCount; i++)
+		change = glm::max(change, glm::abs(radiosity[i] - previous[i]));
+	return change;
+}
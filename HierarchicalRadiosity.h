@@ -0,0 +1,92 @@
+#ifndef HIERARCHICAL_RADIOSITY_H
+#define HIERARCHICAL_RADIOSITY_H
+
+#include "PatchTable.h"
+#include "UniformGrid.h"
+#include "ThreadPool.h"
+
+#include <vector>
+#include <random>
+
+#include <glm/vec3.hpp>
+#include <glm/glm.hpp>
+
+using namespace std;
+
+#define HIERARCHICAL_FORM_FACTOR_EPSILON	0.02 // node pairs with a larger estimated form factor are split further
+#define HIERARCHICAL_MIN_AREA_FRACTION		(1.0f / 1024.0f) // nodes below this fraction of the largest patch are never split
+#define HIERARCHICAL_VISIBILITY_SAMPLES		4 // rays per link to estimate partial occlusion
+#define HIERARCHICAL_PLANE_TOLERANCE		1e-3f // patch centroids this far (times the face size) off an input face still lie on it
+#define HIERARCHICAL_AREA_TOLERANCE			1.01f // a node up to this much larger than a patch still has the patch size
+
+// A piece of an input face. Triangles are bisected on their longest edge, quads are
+// split into four like Mesh::Subdivide, so every input face gets a binary tree or a quadtree.
+struct HierarchyNode
+{
+	glm::vec3 corners[4]; // triangles leave the last one unused
+	int cornerCount;
+	glm::vec3 normal;
+	glm::vec3 centroid;
+	float area;
+	int patch; // a scene face cut from the same input face, they share its plane and material
+	int firstChild; // children are stored next to each other, -1 for leaves
+	int childCount;
+};
+
+// receiver gathers radiosity from source through formFactor (F_receiver,source times visibility)
+struct HierarchyLink
+{
+	int receiver;
+	int source;
+	double formFactor;
+};
+
+// Hierarchical radiosity (Hanrahan, Salzman and Aupperle 1991). The trees start at the
+// unsubdivided input faces and every pair of them is linked at the coarsest pair of nodes
+// whose estimated form factor is below HIERARCHICAL_FORM_FACTOR_EPSILON, so the link count
+// grows roughly linearly with the number of leaves instead of with its square. Radiosity
+// gathered over the links at any level is pushed down to the leaves and the area weighted
+// average is pulled back up. Each scene face reads the node that matches it in size around
+// its centroid, or the leaf there if the refinement stopped above it.
+class HierarchicalRadiosity
+{
+public:
+	HierarchicalRadiosity() : minArea(0.0f), rootCount(0) {}
+
+	// one tree per input face in roots that holds at least one of the patches, the roots are
+	// nodes 0 .. rootCount - 1. patches are the scene faces the results are read for, each one
+	// must lie inside one of the roots
+	void build(PatchTable& roots, PatchTable& patches, UniformGrid& grid, ThreadPool& pool, vector<mt19937>& generators);
+	void clear();
+
+	// one gathering sweep over all links followed by push-pull, returns the largest change of a patch radiosity
+	glm::dvec3 iterate(vector<glm::dvec3>& emission, vector<glm::dvec3>& reflectance, ThreadPool& pool);
+
+	glm::dvec3 getPatchRadiosity(int patch) { return radiosity[patchNodes[patch]]; }
+	int getNodeCount() { return nodes.size(); }
+	int getLinkCount() { return links.size(); }
+	int getLeafCount();
+
+private:
+	int addNode(glm::vec3* corners, int cornerCount, glm::vec3 normal, int patch);
+	bool split(int node);
+	void refine(int receiver, int source);
+	double estimateFormFactor(int receiver, int source, bool& needsSplit);
+	double estimateCornerFormFactor(int receiver, int source);
+	glm::vec3 samplePoint(HierarchyNode& node, mt19937& generator);
+	double estimateVisibility(HierarchyLink& link, UniformGrid& grid, mt19937& generator);
+	int findPatchNode(int root, glm::vec3 centroid, float area);
+	glm::dvec3 pushPull(int node, glm::dvec3 down, vector<glm::dvec3>& emission);
+
+	vector<HierarchyNode> nodes;
+	vector<HierarchyLink> links; // sorted by receiver once built
+	vector<int> linkOffsets; // links gathered by node i are [linkOffsets[i], linkOffsets[i+1])
+	vector<glm::dvec3> radiosity; // per node, the area weighted average over its leaves
+	vector<glm::dvec3> gathered; // per node, what its own links brought in the last sweep
+	vector<int> patchNodes; // per patch, the node its radiosity is read from
+
+	float minArea;
+	int rootCount;
+};
+
+#endif
@@ -8,10 +8,14 @@
 #include <string>
 #include <vector>
 #include <iterator>
-#include <regex>
+#include <chrono>
+#include <string.h>
+#include <math.h>
 
 
 #include "bitmap_image.hpp"
+#include "MappedFile.h"
+#include "ThreadPool.h"
 
 int totalVertexCount;
 
@@ -21,7 +25,16 @@ int Mesh::getTotalVertexCount() {
 
 Mesh::Mesh()
 {
+	indexedVertices = false;
 
+	vertexBufferID = 0;
+	colorBufferID = 0;
+	elementBufferID = 0;
+	shaderProgramID = 0;
+
+	topologyChanged = true;
+	uploadedVertexCount = 0;
+	uploadedIndexCount = 0;
 }
 
 Mesh::~Mesh()
@@ -156,198 +169,347 @@ void Mesh::parseMaterials(string materialsFileName)
 	fileStream.close();
 }
 
-void Mesh::parseObject(ifstream& fileStream, SceneObject& currentObject, int totalVertexCount)
+// Scanner for the memory mapped OBJ loader. Everything works on [p, end) of the
+// mapped file, no strings or token vectors are created per line.
+static inline bool isBlank(char c)
 {
-	string line;
-	std::string prefix;
-	Material* currentMaterial = NULL;
-	vector<string> tokens;
-	string materialName;
+	return c == ' ' || c == '\t' || c == '\r';
+}
 
-	while (getline(fileStream, line))
+static inline const char* skipBlanks(const char* p, const char* end)
+{
+	while (p < end && isBlank(*p))
+		p++;
+	return p;
+}
+
+static inline const char* skipToken(const char* p, const char* end)
+{
+	while (p < end && !isBlank(*p))
+		p++;
+	return p;
+}
+
+static inline bool startsWith(const char* p, const char* end, const char* prefix)
+{
+	for (; *prefix; p++, prefix++)
+		if (p >= end || *p != *prefix)
+			return false;
+	return true;
+}
+
+static const char* parseInt(const char* p, const char* end, int& value)
+{
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+
+	int result = 0;
+	while (p < end && *p >= '0' && *p <= '9')
+		result = result * 10 + (*p++ - '0');
+
+	value = negative ? -result : result;
+	return p;
+}
+
+static const char* parseFloat(const char* p, const char* end, float& value)
+{
+	static const double powersOfTen[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+
+	//mantissa digits beyond what a double holds exactly only move the exponent
+	unsigned long long mantissa = 0;
+	int significantDigits = 0;
+	int exponent = 0;
+
+	while (p < end && *p >= '0' && *p <= '9')
 	{
-		//found another object, end parsing
-		prefix = "o ";
-		if (!line.compare(0, prefix.size(), prefix))
+		if (significantDigits < 19)
 		{
-			return;
+			mantissa = mantissa * 10 + (*p - '0');
+			if (mantissa > 0)
+				significantDigits++;
 		}
+		else
+			exponent++;
+		p++;
+	}
 
-		//load vertex data
-		prefix = "v ";
-		if (!line.compare(0, prefix.size(), prefix))
+	if (p < end && *p == '.')
+	{
+		p++;
+		while (p < end && *p >= '0' && *p <= '9')
 		{
-			tokens = split(line, " ", false);
+			if (significantDigits < 19)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				if (mantissa > 0)
+					significantDigits++;
+				exponent--;
+			}
+			p++;
+		}
+	}
 
-			double x = stod(tokens[1]);
-			double y = stod(tokens[2]);
-			double z = stod(tokens[3]);
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		int exponentPart;
+		p = parseInt(p + 1, end, exponentPart);
+		exponent += exponentPart;
+	}
 
-			glm::vec3 vertex((float)x, (float)y, (float)z);
-			currentObject.obj_model.vertices.push_back(vertex);
-		}
+	double result = (double)mantissa;
+	if (exponent > 0)
+		result *= exponent <= 22 ? powersOfTen[exponent] : pow(10.0, exponent);
+	else if (exponent < 0)
+		result /= exponent >= -22 ? powersOfTen[-exponent] : pow(10.0, -exponent);
 
-		//load texture UV/W coordinates
-		prefix = "vt ";
-		if (!line.compare(0, prefix.size(), prefix))
-		{
-			tokens = split(line, " ", false);
+	value = (float)(negative ? -result : result);
+	return p;
+}
 
-			float u = stod(tokens[1]);
-			float v = stod(tokens[2]);
-			float w = 0.0f;
-			if (tokens.size() > 3)
-				w = stod(tokens[3]);
+Material* Mesh::getMaterialPtrByName(const char* name, int length)
+{
+	for (int i = 0; i<materials.size(); i++)
+		if (materials[i].name.size() == length && !materials[i].name.compare(0, length, name, length))
+			return &materials[i];
+	return NULL;
+}
 
-			glm::vec3 textureUVW_coord(u, v, w);
-			currentObject.obj_model.textureUVW.push_back(textureUVW_coord);
-		}
+// Parses the lines of one object, [begin, end) must not contain its "o " line.
+// Same results as the old getline/split parser: indexes are made local by
+// subtracting totalVertexCount, and the face layout (v, v//n or v/t/n) is taken
+// from the first corner of each face.
+void Mesh::parseObjectRange(const char* begin, const char* end, SceneObject& currentObject, int totalVertexCount)
+{
+	ObjectModel& model = currentObject.obj_model;
+	Material* currentMaterial = NULL;
+	vector<GLuint> polygonVertices, polygonTextures, polygonNormals;
+
+	const char* line = begin;
+	while (line < end)
+	{
+		const char* lineEnd = (const char*)memchr(line, '\n', end - line);
+		if (lineEnd == NULL)
+			lineEnd = end;
+
+		const char* p = line;
+		line = lineEnd + 1;
 
+		//load vertex data
+		if (startsWith(p, lineEnd, "v "))
+		{
+			glm::vec3 vertex;
+			p = parseFloat(skipBlanks(p + 2, lineEnd), lineEnd, vertex.x);
+			p = parseFloat(skipBlanks(p, lineEnd), lineEnd, vertex.y);
+			p = parseFloat(skipBlanks(p, lineEnd), lineEnd, vertex.z);
+			model.vertices.push_back(vertex);
+		}
+		//load texture UV/W coordinates
+		else if (startsWith(p, lineEnd, "vt "))
+		{
+			glm::vec3 textureUVW_coord(0.0f, 0.0f, 0.0f);
+			p = parseFloat(skipBlanks(p + 3, lineEnd), lineEnd, textureUVW_coord.x);
+			p = parseFloat(skipBlanks(p, lineEnd), lineEnd, textureUVW_coord.y);
+			p = skipBlanks(p, lineEnd);
+			if (p < lineEnd)
+				parseFloat(p, lineEnd, textureUVW_coord.z);
+			model.textureUVW.push_back(textureUVW_coord);
+		}
 		//load vertex normals data
-		prefix = "vn ";
-		if (!line.compare(0, prefix.size(), prefix))
+		else if (startsWith(p, lineEnd, "vn "))
 		{
-			tokens = split(line, " ", false);
-			glm::vec3 vertexNormal(stod(tokens[1]), stod(tokens[2]), stod(tokens[3]));
-			currentObject.obj_model.vertexNormals.push_back(vertexNormal);
+			glm::vec3 vertexNormal;
+			p = parseFloat(skipBlanks(p + 3, lineEnd), lineEnd, vertexNormal.x);
+			p = parseFloat(skipBlanks(p, lineEnd), lineEnd, vertexNormal.y);
+			p = parseFloat(skipBlanks(p, lineEnd), lineEnd, vertexNormal.z);
+			model.vertexNormals.push_back(vertexNormal);
 		}
-
-
 		//load face materials
-		prefix = "usemtl ";
-		if (!line.compare(0, prefix.size(), prefix))
+		else if (startsWith(p, lineEnd, "usemtl "))
 		{
-			tokens = split(line, " ", false);
-			currentMaterial = getMaterialPtrByName(tokens[1]);
-			materialName = currentMaterial->name;
+			p = skipBlanks(p + 7, lineEnd);
+			const char* nameEnd = skipToken(p, lineEnd);
+			currentMaterial = getMaterialPtrByName(p, nameEnd - p);
+			if (currentMaterial == NULL)
+				printf("Unknown material %.*s\n", (int)(nameEnd - p), p);
 		}
 		//load faces
-		prefix = "f ";
-		if (!line.compare(0, prefix.size(), prefix))
+		else if (startsWith(p, lineEnd, "f "))
 		{
-			tokens = split(line, " ", false);
-			ModelFace face;
+			p = skipBlanks(p + 2, lineEnd);
+
+			int numIndexes = 0;
+			for (const char* token = p; token < lineEnd; token = skipBlanks(skipToken(token, lineEnd), lineEnd))
+				numIndexes++;
+			if (numIndexes == 0)
+				continue;
+
+			const char* firstTokenEnd = skipToken(p, lineEnd);
+			const char* firstSlash = (const char*)memchr(p, '/', firstTokenEnd - p);
+			bool vertexNormal = firstSlash != NULL && firstSlash + 1 < firstTokenEnd && firstSlash[1] == '/';
+			bool vertexTextureNormal = !vertexNormal && firstSlash != NULL && memchr(firstSlash + 1, '/', firstTokenEnd - firstSlash - 1) != NULL;
 
-			int numIndexes = tokens.size() - 1;
-			if (tokens[1].find("//") != string::npos) //we have vertex//normals
+			// corners go to buffers reused across faces, only polygons larger than any before allocate
+			polygonVertices.resize(numIndexes);
+			polygonTextures.resize(numIndexes);
+			polygonNormals.resize(numIndexes);
+
+			for (int i = 0; i < numIndexes; i++)
 			{
-				face.vertexIndexes.resize(numIndexes);
-				face.normalIndexes.resize(numIndexes);
+				const char* tokenEnd = skipToken(p, lineEnd);
+				int index;
+
+				p = parseInt(p, tokenEnd, index);
+				polygonVertices[i] = index - totalVertexCount - 1;
 
-				for (int i = 1; i<tokens.size(); i++)
+				if (vertexNormal) //we have vertex//normals
 				{
-					vector<string> tmp = split(tokens[i], "//", false);
-					face.vertexIndexes[i - 1] = stoi(tmp[0]) - totalVertexCount - 1;
-					face.normalIndexes[i - 1] = stoi(tmp[1]) - totalVertexCount - 1;
-					/*if (stoi(tmp[0]) - totalVertexCount - 1 < 0) {
-					printf("obj id is %d \n", currentObject.obj_id);
-					printf("token size is %d \n", tokens.size());
-					printf("token is %s \n", tokens[i].c_str());
-					printf("current material is %s \n", materialName.c_str());
-					printf("vertex is %d", stoi(tmp[0]));
-					printf("totalVertexCount is %d", totalVertexCount);
-					printf("vertexIndex %d \n ", face.vertexIndexes[i - 1]);
-					printf("normalindex %d \n", face.normalIndexes[i - 1]);
-					}*/
+					parseInt(p + 2, tokenEnd, index);
+					polygonNormals[i] = index - totalVertexCount - 1;
 				}
-			}
-			else if (regex_match(tokens[1], regex("\\d+/\\d+/\\d+"))) //we have vertex/texture/normal
-			{
-				face.vertexIndexes.resize(numIndexes);
-				face.normalIndexes.resize(numIndexes);
-				face.textureIndexes.resize(numIndexes);
-
-				for (int i = 1; i<tokens.size(); i++)
+				else if (vertexTextureNormal) //we have vertex/texture/normal
 				{
-					vector<string> tmp = split(tokens[i], "/", false);
-					face.vertexIndexes[i - 1] = stoi(tmp[0]) - totalVertexCount - 1;
-					face.textureIndexes[i - 1] = stoi(tmp[1]) - totalVertexCount - 1;
-					face.normalIndexes[i - 1] = stoi(tmp[2]) - totalVertexCount - 1;
+					p = parseInt(p + 1, tokenEnd, index);
+					polygonTextures[i] = index - totalVertexCount - 1;
+					parseInt(p + 1, tokenEnd, index);
+					polygonNormals[i] = index - totalVertexCount - 1;
 				}
+
+				p = skipBlanks(tokenEnd, lineEnd);
 			}
-			else //we have vertex vertex
-			{
-				face.vertexIndexes.resize(numIndexes);
-				//face.textureIndexes.resize(numIndexes);
 
-				for (int i = 1; i<tokens.size(); i++)
+			// triangles and quads are kept, larger polygons become a fan of triangles around the first corner
+			int cornerCount = numIndexes <= MAX_FACE_CORNERS ? numIndexes : 3;
+			int faceCount = numIndexes <= MAX_FACE_CORNERS ? 1 : numIndexes - 2;
+			for (int f = 0; f < faceCount; f++)
+			{
+				ModelFace face;
+				for (int k = 0; k < cornerCount; k++)
 				{
-					//vector<string> tmp = split(tokens[i], " ", false);
-					face.vertexIndexes[i - 1] = stoi(tokens[i]) - totalVertexCount - 1;
-					//face.textureIndexes[i-1] = stoi(tmp[1]) - totalVertexCount - 1;
+					// fan triangle f uses corners 0, f + 1, f + 2
+					int corner = k == 0 ? 0 : f + k;
+					face.vertexIndexes.push_back(polygonVertices[corner]);
+					if (vertexNormal || vertexTextureNormal)
+						face.normalIndexes.push_back(polygonNormals[corner]);
+					if (vertexTextureNormal)
+						face.textureIndexes.push_back(polygonTextures[corner]);
 				}
+				face.material = currentMaterial;
+				model.faces.push_back(face);
 			}
-			face.material = currentMaterial;
-			currentObject.obj_model.faces.push_back(face);
 		}
 	}
 }
 
 void Mesh::Load(string input_file)
 {
-	ifstream fileStream(input_file, ios::in);
+	topologyChanged = true;
+	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
 
-	if (!fileStream)
+	MappedFile file;
+	if (!file.open(input_file))
 	{
 		cout << "ERROR: cannot open file " << input_file << endl;
 		exit(1);
 	}
 
+	const char* data = file.getData();
+	const char* end = data + file.getSize();
 
+	// one pass for the materials file, the object boundaries and the vertex count of
+	// every object. Everything before the first "o " line ends up in an object of its
+	// own which is dropped below, like before
+	vector<const char*> objectBegins(1, data);
+	vector<const char*> objectEnds;
+	vector<int> objectVertexCounts(1, 0);
+	vector<int> objectFaceCounts(1, 0); // before fanning, polygons larger than quads add faces
+	bool materialsLoaded = false;
 
-	string line;
-	std::string prefix;
-	int currentObjectId = 0;
-
-	int streamPos = 0;
-
-	while (getline(fileStream, line))
+	for (const char* line = data; line < end;)
 	{
+		const char* lineEnd = (const char*)memchr(line, '\n', end - line);
+		if (lineEnd == NULL)
+			lineEnd = end;
+
 		//parse materials file
-		prefix = "mtllib ";
-		if (!line.compare(0, prefix.size(), prefix))
+		if (!materialsLoaded && startsWith(line, lineEnd, "mtllib "))
 		{
-			vector<string> tokens = split(line, " ", false);
-			parseMaterials(tokens[1]);
-			break;
+			const char* name = skipBlanks(line + 7, lineEnd);
+			parseMaterials(string(name, skipToken(name, lineEnd)));
+			materialsLoaded = true;
+		}
+		else if (line[0] == 'v' && line + 1 < lineEnd && line[1] == ' ')
+			objectVertexCounts.back()++;
+		else if (line[0] == 'f' && line + 1 < lineEnd && line[1] == ' ')
+			objectFaceCounts.back()++;
+		//found another object
+		else if (startsWith(line, lineEnd, "o "))
+		{
+			objectEnds.push_back(line);
+			objectBegins.push_back(min(lineEnd + 1, end));
+			objectVertexCounts.push_back(0);
+			objectFaceCounts.push_back(0);
 		}
-	}
 
-	fileStream.seekg(ios_base::beg);
+		line = lineEnd + 1;
+	}
+	objectEnds.push_back(end);
 
+	//the vertex counts give every object its global index offset before anything is parsed
+	int objectCount = objectBegins.size();
+	vector<int> vertexOffsets(objectCount);
 	totalVertexCount = 0;
-	int lastVertexCount = 0;
-
-	while (!fileStream.eof())
+	for (int i = 0; i < objectCount; i++)
 	{
-		//found another object, end parsing
-
-		SceneObject currentObject;
-		currentObject.obj_id = currentObjectId;
-		parseObject(fileStream, currentObject, totalVertexCount);
-		currentObject.obj_model.vertexIndexOffset = lastVertexCount;
-
-		totalVertexCount += currentObject.obj_model.vertices.size();
-		lastVertexCount = totalVertexCount;
-
-		sceneModel.push_back(currentObject);
-		currentObjectId++;
+		vertexOffsets[i] = totalVertexCount;
+		totalVertexCount += objectVertexCounts[i];
 	}
-	fileStream.close();
+
+	sceneModel.clear();
+	sceneModel.resize(objectCount);
+
+	//objects are independent once their offsets are known, parse them in place on every core
+	ThreadPool pool;
+	pool.parallelFor(objectCount, [&](int i, int) {
+		SceneObject& currentObject = sceneModel[i];
+		currentObject.obj_id = i;
+		currentObject.obj_model.vertices.reserve(objectVertexCounts[i]);
+		currentObject.obj_model.faces.reserve(objectFaceCounts[i]);
+		parseObjectRange(objectBegins[i], objectEnds[i], currentObject, vertexOffsets[i]);
+		currentObject.obj_model.vertexIndexOffset = vertexOffsets[i];
+		currentObject.obj_model.buildFaceTables();
+	});
 
 	sceneModel.erase(sceneModel.begin());
 
-	startingSceneModel = sceneModel;
+	startingSceneModel.clear();
+	startingSceneModel.resize(sceneModel.size());
+	pool.parallelFor(sceneModel.size(), [&](int i, int) {
+		startingSceneModel[i] = sceneModel[i];
+	});
+
+	double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+	double megabytes = file.getSize() / (1024.0 * 1024.0);
+	printf("Loaded %s: %d objects, %.1f MB in %f s (%.1f MB/s, %d threads)\n", input_file.c_str(), (int)sceneModel.size(), megabytes, seconds, seconds > 0.0 ? megabytes / seconds : 0.0, pool.getThreadCount());
 }
 
 void Mesh::ResetMesh()
 {
 	sceneModel = startingSceneModel;
+	topologyChanged = true;
 }
 
-void Mesh::Subdivide()
+void Mesh::Subdivide(vector<vector<bool>>* facesToSplit)
 {
 	int firstObjectVertexOffset = 0;
+	topologyChanged = true;
 
 	for (int i = 0; i<sceneModel.size(); i++)
 	{
@@ -361,7 +523,10 @@ void Mesh::Subdivide()
 
 		for (int j = 0; j < currentObjFaces; j++)
 		{
-			//for every face of it
+			//for every face of it, new faces are appended after currentObjFaces and not split again
+			if (facesToSplit != NULL && !(*facesToSplit)[i][j])
+				continue;
+
 			ModelFace* currentFace = &sceneModel[i].obj_model.faces[j];
 
 			Material* currentMaterial = currentFace->material;
@@ -603,6 +768,9 @@ void Mesh::Subdivide()
 			}
 		}
 	}
+
+	for (int i = 0; i < sceneModel.size(); i++)
+		sceneModel[i].obj_model.buildFaceTables();
 }
 
 vector<ModelFace*> Mesh::GetFaceIndexesFromVertexIndex(int modelIndex, int vertIndex)
@@ -684,23 +852,21 @@ vector<int> Mesh::GetFaceIndexesFromVertexIndex_Radiosity(int modelIndex, int ve
 
 glm::vec3 Mesh::interpolatedColorForVertex(int modelIndex, int currentFaceIndex, int currentVertex)
 {
-	// updating the interpolated color display
-	vector<int> incidentFaces = GetFaceIndexesFromVertexIndex_Radiosity(modelIndex, currentVertex);
-	int numIncidentFaces = incidentFaces.size();
+	// updating the interpolated color display, area weighted over the incident faces
+	// facing roughly the same way. Uses the adjacency and normal/area tables of the model
 	float total = 0.0f;
 	glm::vec3 color(0.0f, 0.0f, 0.0f);
 	ObjectModel* currentModel = &sceneModel[modelIndex].obj_model;
 
-	glm::vec3 normal = currentModel->getFaceNormal(currentFaceIndex);
+	glm::vec3 normal = currentModel->faceNormals[currentFaceIndex];
 
-	for (int i = 0; i<numIncidentFaces; i++)
+	for (int k = currentModel->vertexFaceOffsets[currentVertex]; k < currentModel->vertexFaceOffsets[currentVertex + 1]; k++)
 	{
-		glm::vec3 normal2 = currentModel->getFaceNormal(incidentFaces[i]);
-		if (glm::dot(normal, normal2) < 0.9f)
+		int incidentFace = currentModel->vertexFaces[k];
+		if (glm::dot(normal, currentModel->faceNormals[incidentFace]) < 0.9f)
 			continue;
-		total += currentModel->getFaceArea(incidentFaces[i]);
-		color += currentModel->getFaceArea(incidentFaces[i]) * currentModel->faces[incidentFaces[i]].intensity;
-
+		total += currentModel->faceAreas[incidentFace];
+		color += currentModel->faceAreas[incidentFace] * currentModel->faces[incidentFace].intensity;
 	}
 	if (total > 0.0f)
 		color /= total;
@@ -710,6 +876,12 @@ glm::vec3 Mesh::interpolatedColorForVertex(int modelIndex, int currentFaceIndex,
 
 void Mesh::cacheVerticesFacesAndColors_Radiosity_II()
 {
+	if (indexedVertices)
+	{
+		cacheVerticesFacesAndColors_Indexed(true);
+		return;
+	}
+
 	vertex_positions.clear();
 	face_indexes.clear();
 	vertex_colors.clear();
@@ -718,7 +890,7 @@ void Mesh::cacheVerticesFacesAndColors_Radiosity_II()
 	{
 		for (int j = 0; j<sceneModel[i].obj_model.faces.size(); j++)
 		{
-			ModelFace currentFace = sceneModel[i].obj_model.faces[j];
+			ModelFace& currentFace = sceneModel[i].obj_model.faces[j];
 
 			glm::vec3 color_a;
 			glm::vec3 color_b;
@@ -1041,8 +1213,116 @@ void Mesh::cacheVerticesFacesAndColors_Radiosity()
 	}
 }
 
+//returns the index of an already emitted copy of the vertex with the same color, or emits a new one.
+//emittedHead[vertexIndex] starts a chain through emittedNext of every copy of that model vertex.
+GLuint Mesh::emitVertex(glm::vec3 position, glm::vec3 color, int vertexIndex, vector<int>& emittedHead, vector<int>& emittedNext)
+{
+	for (int emitted = emittedHead[vertexIndex]; emitted != -1; emitted = emittedNext[emitted])
+	{
+		if (vertex_colors[3 * emitted] == color.r && vertex_colors[3 * emitted + 1] == color.g && vertex_colors[3 * emitted + 2] == color.b)
+			return emitted;
+	}
+
+	GLuint index = vertex_positions.size() / 3;
+	vertex_positions.push_back(position.x);
+	vertex_positions.push_back(position.y);
+	vertex_positions.push_back(position.z);
+
+	vertex_colors.push_back(color.r);
+	vertex_colors.push_back(color.g);
+	vertex_colors.push_back(color.b);
+
+	emittedNext.push_back(emittedHead[vertexIndex]);
+	emittedHead[vertexIndex] = index;
+	return index;
+}
+
+//same output as cacheVerticesFacesAndColors (or _Radiosity_II when interpolating) but every
+//model vertex is emitted once per distinct color and the faces index into the shared copies
+void Mesh::cacheVerticesFacesAndColors_Indexed(bool interpolate)
+{
+	//which corners get shared depends on the colors, so a new solution can change the layout
+	//even when the model did not. Keep the old indexes to tell PrepareToDraw about it.
+	vector<GLuint> previousIndexes;
+	previousIndexes.swap(face_indexes);
+
+	vertex_positions.clear();
+	face_indexes.clear();
+	vertex_colors.clear();
+
+	int indexCount = 0;
+	int vertexCount = 0;
+	for (int i = 0; i < sceneModel.size(); i++)
+	{
+		vertexCount += sceneModel[i].obj_model.vertices.size();
+		for (int j = 0; j < sceneModel[i].obj_model.faces.size(); j++)
+			indexCount += sceneModel[i].obj_model.faces[j].vertexIndexes.size() == 4 ? 6 : 3;
+	}
+
+	//flat shading gives a vertex one copy per distinct neighbouring color, so this is a lower bound
+	face_indexes.reserve(indexCount);
+	vertex_positions.reserve(3 * vertexCount);
+	vertex_colors.reserve(3 * vertexCount);
+
+	vector<int> emittedHead;
+	vector<int> emittedNext;
+	emittedNext.reserve(vertexCount);
+
+	for (int i = 0; i < sceneModel.size(); i++)
+	{
+		ObjectModel& model = sceneModel[i].obj_model;
+		emittedHead.assign(model.vertices.size(), -1);
+
+		for (int j = 0; j < model.faces.size(); j++)
+		{
+			ModelFace& currentFace = model.faces[j];
+			int cornerCount = currentFace.vertexIndexes.size();
+			if (cornerCount != 3 && cornerCount != 4)
+			{
+				printf("Model doesn't have triangles or quads. Can't process\n");
+				return;
+			}
+
+			GLuint corners[4];
+			for (int k = 0; k < cornerCount; k++)
+			{
+				int vertexIndex = currentFace.vertexIndexes[k];
+				glm::vec3 color = interpolate ? interpolatedColorForVertex(i, j, vertexIndex) : currentFace.intensity;
+				corners[k] = emitVertex(model.vertices[vertexIndex], color, vertexIndex, emittedHead, emittedNext);
+			}
+
+			if (cornerCount == 3)
+			{
+				face_indexes.push_back(corners[0]);
+				face_indexes.push_back(corners[1]);
+				face_indexes.push_back(corners[2]);
+			}
+			else
+			{
+				//ABD and BCD, like the unindexed path
+				face_indexes.push_back(corners[0]);
+				face_indexes.push_back(corners[1]);
+				face_indexes.push_back(corners[3]);
+
+				face_indexes.push_back(corners[1]);
+				face_indexes.push_back(corners[2]);
+				face_indexes.push_back(corners[3]);
+			}
+		}
+	}
+
+	if (face_indexes != previousIndexes)
+		topologyChanged = true;
+}
+
 void Mesh::cacheVerticesFacesAndColors()
 {
+	if (indexedVertices)
+	{
+		cacheVerticesFacesAndColors_Indexed(false);
+		return;
+	}
+
 	vertex_positions.clear();
 	face_indexes.clear();
 	vertex_colors.clear();
@@ -1213,26 +1493,42 @@ GLuint Mesh::LoadGouraudShaders()
 
 void Mesh::PrepareToDraw()
 {
-	//cacheVerticesFacesAndColors();
+	if (vertexBufferID == 0)
+	{
+		glGenBuffers(1, &vertexBufferID);
+		glGenBuffers(1, &colorBufferID);
+		glGenBuffers(1, &elementBufferID);
+		topologyChanged = true;
+	}
 
-	//create a vertex buffer
-	glGenBuffers(1, &vertexBufferID);
-	glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
+	int vertexCount = vertex_positions.size() / 3;
+	int indexCount = face_indexes.size();
+	if (vertexCount != uploadedVertexCount || indexCount != uploadedIndexCount)
+		topologyChanged = true;
+
+	if (!topologyChanged)
+	{
+		//same vertices and faces as last time, only the radiosity colors are new
+		glBindBuffer(GL_ARRAY_BUFFER, colorBufferID);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, vertex_colors.size() * sizeof(GLfloat), vertex_colors.data());
+		return;
+	}
 
 	//fill the vertex buffer with our mesh's data
-	glBufferData(GL_ARRAY_BUFFER, vertex_positions.size() * sizeof(GLfloat), &vertex_positions[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
+	glBufferData(GL_ARRAY_BUFFER, vertex_positions.size() * sizeof(GLfloat), vertex_positions.data(), GL_STATIC_DRAW);
 
-	//create a color buffer
-	glGenBuffers(1, &colorBufferID);
+	//fill the color buffer, rewritten after every solution
 	glBindBuffer(GL_ARRAY_BUFFER, colorBufferID);
-	//fill the color buffer
-	glBufferData(GL_ARRAY_BUFFER, vertex_colors.size() * sizeof(GLfloat), &vertex_colors[0], GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, vertex_colors.size() * sizeof(GLfloat), vertex_colors.data(), GL_DYNAMIC_DRAW);
 
-	// Generate a buffer for the indices
-	glGenBuffers(1, &elementBufferID);
+	//fill the index buffer
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementBufferID);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, face_indexes.size() * sizeof(GLuint), &face_indexes[0], GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, face_indexes.size() * sizeof(GLuint), face_indexes.data(), GL_STATIC_DRAW);
 
+	uploadedVertexCount = vertexCount;
+	uploadedIndexCount = indexCount;
+	topologyChanged = false;
 }
 
 void Mesh::Draw()
@@ -1293,7 +1589,7 @@ void Mesh::Draw()
 	//draw the data we gave as a triangle
 	glDrawElements(
 		GL_TRIANGLES,      // mode
-		face_indexes.size(),    // count
+		uploadedIndexCount,    // count
 		GL_UNSIGNED_INT,   // type
 		(void*)0           // element array buffer offset
 	);
@@ -1310,6 +1606,13 @@ void Mesh::Cleanup()
 	glDeleteBuffers(1, &colorBufferID);
 	glDeleteBuffers(1, &elementBufferID);
 	glDeleteProgram(shaderProgramID);
+
+	vertexBufferID = 0;
+	colorBufferID = 0;
+	elementBufferID = 0;
+	shaderProgramID = 0;
+	uploadedVertexCount = 0;
+	uploadedIndexCount = 0;
 }
 
 void Mesh::OutputToBitmap(string bmpName, int width, int height)
@@ -1338,4 +1641,89 @@ void Mesh::OutputToBitmap(string bmpName, int width, int height)
 	image.import_rgb(red_channel, green_channel, blue_channel);
 
 	image.save_image(bmpName);
-}
\ No newline at end of file
+}
+
+// Software version of Draw + OutputToBitmap for runs without a GL context. Draws the
+// triangles cached by the last cacheVerticesFacesAndColors* call with the current MVP,
+// a depth test and back face culling like the GL state set up in main.
+void Mesh::RasterizeToBitmap(string bmpName, int width, int height, glm::vec3 bgcolor)
+{
+	vector<float> depth(width * height, 1.0f);
+	vector<glm::vec3> colors(width * height, bgcolor);
+
+	for (int t = 0; t + 2 < face_indexes.size(); t += 3)
+	{
+		glm::vec3 screen[3];
+		glm::vec3 color[3];
+		float invW[3];
+		bool visible = true;
+
+		for (int k = 0; k < 3; k++)
+		{
+			int v = face_indexes[t + k];
+			glm::vec4 clip = ModelViewProjectionMatrix * glm::vec4(vertex_positions[3 * v], vertex_positions[3 * v + 1], vertex_positions[3 * v + 2], 1.0f);
+
+			//no near plane clipping, triangles reaching behind the camera are dropped
+			if (clip.w <= 1e-6f)
+			{
+				visible = false;
+				break;
+			}
+
+			invW[k] = 1.0f / clip.w;
+			screen[k] = glm::vec3(
+				(clip.x * invW[k] * 0.5f + 0.5f) * width,
+				(0.5f - clip.y * invW[k] * 0.5f) * height, //row 0 is the top of the image
+				clip.z * invW[k]);
+			color[k] = glm::vec3(vertex_colors[3 * v], vertex_colors[3 * v + 1], vertex_colors[3 * v + 2]);
+		}
+		if (!visible)
+			continue;
+
+		//counter clockwise front faces turn clockwise once y points down
+		float area = (screen[1].x - screen[0].x) * (screen[2].y - screen[0].y) - (screen[2].x - screen[0].x) * (screen[1].y - screen[0].y);
+		if (area >= 0.0f)
+			continue;
+
+		int minX = max(0, (int)floor(min(screen[0].x, min(screen[1].x, screen[2].x))));
+		int maxX = min(width - 1, (int)ceil(max(screen[0].x, max(screen[1].x, screen[2].x))));
+		int minY = max(0, (int)floor(min(screen[0].y, min(screen[1].y, screen[2].y))));
+		int maxY = min(height - 1, (int)ceil(max(screen[0].y, max(screen[1].y, screen[2].y))));
+
+		for (int y = minY; y <= maxY; y++)
+		{
+			for (int x = minX; x <= maxX; x++)
+			{
+				float px = x + 0.5f;
+				float py = y + 0.5f;
+
+				float b0 = ((screen[2].x - screen[1].x) * (py - screen[1].y) - (screen[2].y - screen[1].y) * (px - screen[1].x)) / area;
+				float b1 = ((screen[0].x - screen[2].x) * (py - screen[2].y) - (screen[0].y - screen[2].y) * (px - screen[2].x)) / area;
+				float b2 = 1.0f - b0 - b1;
+				if (b0 < 0.0f || b1 < 0.0f || b2 < 0.0f)
+					continue;
+
+				float z = b0 * screen[0].z + b1 * screen[1].z + b2 * screen[2].z;
+				int pixel = y * width + x;
+				if (z < -1.0f || z >= depth[pixel])
+					continue;
+
+				//colors are interpolated perspective correct, like GL does
+				float w0 = b0 * invW[0], w1 = b1 * invW[1], w2 = b2 * invW[2];
+				depth[pixel] = z;
+				colors[pixel] = (w0 * color[0] + w1 * color[1] + w2 * color[2]) / (w0 + w1 + w2);
+			}
+		}
+	}
+
+	bitmap_image image(width, height);
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			glm::vec3 c = glm::clamp(colors[y * width + x], 0.0f, 1.0f);
+			image.set_pixel(x, y, (unsigned char)(c.r * 255.0f), (unsigned char)(c.g * 255.0f), (unsigned char)(c.b * 255.0f));
+		}
+	}
+	image.save_image(bmpName);
+}
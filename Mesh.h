@@ -25,7 +25,8 @@ public:
 	
 	void Load(string input_file);
 
-	void Subdivide();
+	// splits every face, or only the faces marked in facesToSplit[object][face]
+	void Subdivide(vector<vector<bool>>* facesToSplit = NULL);
 	void ResetMesh();
 	void PrepareToDraw();
 	void DrawWireframe();
@@ -35,6 +36,7 @@ public:
 	vector<ModelFace*> GetFaceIndexesFromVertexIndex(int modelIndex, int vertIndex);
 
 	void OutputToBitmap(string bmpName, int width, int height);
+	void RasterizeToBitmap(string bmpName, int width, int height, glm::vec3 bgcolor);
 	int Mesh::getTotalVertexCount();
 
 	GLuint LoadDefaultShaders();
@@ -50,22 +52,33 @@ public:
 	void cacheVerticesFacesAndColors();
 	void cacheVerticesFacesAndColors_Radiosity();
 	void cacheVerticesFacesAndColors_Radiosity_II();
+	void cacheVerticesFacesAndColors_Indexed(bool interpolate);
+
+	// share corners with the same position and color instead of emitting three per triangle
+	void SetIndexedVertices(bool indexed) { indexedVertices = indexed; }
 
 
 private:
 
-	void parseObject(ifstream& fileStream, SceneObject& currentObject, int totalVertexCount);
+	void parseObjectRange(const char* begin, const char* end, SceneObject& currentObject, int totalVertexCount);
 
 	void parseMaterials(string materialsFileName);
 	Material* getMaterialPtrByName(string matName);
+	Material* getMaterialPtrByName(const char* name, int length);
 
 	vector<GLfloat> vertex_positions;
 	vector<GLfloat> vertex_colors;
 	vector<GLuint> face_indexes;
 	vector<GLfloat> face_normals;
 
+	bool indexedVertices;
+	GLuint emitVertex(glm::vec3 position, glm::vec3 color, int vertexIndex, vector<int>& emittedHead, vector<int>& emittedNext);
+
 public:	
 	vector<SceneObject> sceneModel;
+
+	// the faces as loaded, before any Subdivide
+	vector<SceneObject>& getStartingSceneModel() { return startingSceneModel; }
 private:	
 	vector<SceneObject> startingSceneModel;
 
@@ -81,6 +94,13 @@ private:
 	GLuint elementBufferID;
 	GLuint shaderProgramID;
 
+	//the GL buffers live as long as the mesh. PrepareToDraw reallocates them only when
+	//topologyChanged is set or the cached sizes differ from what was uploaded,
+	//otherwise it rewrites the color buffer in place
+	bool topologyChanged;
+	int uploadedVertexCount;
+	int uploadedIndexCount;
+
 
 
 	glm::vec3 interpolatedColorForVertex(int modelIndex, int currentFaceIndex, int currentVertex);
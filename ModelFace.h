@@ -3,14 +3,54 @@
 
 #include "Material.h"
 
+#include <assert.h>
+
+#define MAX_FACE_CORNERS	4 // triangles and quads, Mesh::Load fans larger polygons into triangles
+
+// Corner indexes of one face, stored inline instead of in a vector. Every face owned
+// three vectors before, that is three heap blocks and 72 bytes of headers per face.
+// Keeps the part of the vector interface the mesh code uses.
+struct FaceIndexArray
+{
+	GLuint indexes[MAX_FACE_CORNERS];
+	unsigned char count;
+
+	FaceIndexArray() : count(0) {}
+
+	int size() const { return count; }
+	bool empty() const { return count == 0; }
+	void clear() { count = 0; }
+
+	void resize(int newCount)
+	{
+		assert(newCount >= 0 && newCount <= MAX_FACE_CORNERS);
+		for (int k = count; k < newCount; k++)
+			indexes[k] = 0;
+		count = newCount;
+	}
+
+	void push_back(GLuint index)
+	{
+		assert(count < MAX_FACE_CORNERS);
+		indexes[count++] = index;
+	}
+
+	GLuint& operator[](int k) { return indexes[k]; }
+	const GLuint& operator[](int k) const { return indexes[k]; }
+
+	GLuint* begin() { return indexes; }
+	GLuint* end() { return indexes + count; }
+};
+
+// the pointer and the vec3 come first so the three index arrays share one padded tail
 struct ModelFace
 {
-	vector<GLuint> vertexIndexes;
-	vector<GLuint> textureIndexes;
-	vector<GLuint> normalIndexes;
 	Material* material;
-
 	glm::vec3 intensity;
+
+	FaceIndexArray vertexIndexes;
+	FaceIndexArray textureIndexes; // empty unless the file gave v/t/n corners
+	FaceIndexArray normalIndexes; // empty for plain v corners
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -11,6 +11,7 @@
 
 #include <vector>
 #include <string>
+#include <random>
 
 #include "ModelFace.h"
 
@@ -24,6 +25,41 @@ struct ObjectModel
 	vector<ModelFace> faces;
 	int vertexIndexOffset;
 
+	// vertex to face adjacency in CSR layout: the faces around vertex v are
+	// vertexFaces[vertexFaceOffsets[v]] .. vertexFaces[vertexFaceOffsets[v+1]-1]
+	vector<int> vertexFaceOffsets;
+	vector<int> vertexFaces;
+	vector<glm::vec3> faceNormals;
+	vector<float> faceAreas;
+
+	// rebuilds the tables above, needed whenever faces or vertices change
+	void buildFaceTables()
+	{
+		vertexFaceOffsets.assign(vertices.size() + 1, 0);
+		faceNormals.resize(faces.size());
+		faceAreas.resize(faces.size());
+
+		for (int i = 0; i < faces.size(); i++)
+		{
+			for (int j = 0; j < faces[i].vertexIndexes.size(); j++)
+				vertexFaceOffsets[faces[i].vertexIndexes[j] + 1]++;
+
+			faceNormals[i] = getFaceNormal(i);
+			faceAreas[i] = getFaceArea(i);
+		}
+
+		for (int v = 0; v < vertices.size(); v++)
+			vertexFaceOffsets[v + 1] += vertexFaceOffsets[v];
+
+		// faces are visited in order so every vertex lists its faces sorted, a face
+		// using the same vertex twice is listed twice
+		vertexFaces.resize(vertexFaceOffsets.back());
+		vector<int> cursor(vertexFaceOffsets.begin(), vertexFaceOffsets.end() - 1);
+		for (int i = 0; i < faces.size(); i++)
+			for (int j = 0; j < faces[i].vertexIndexes.size(); j++)
+				vertexFaces[cursor[faces[i].vertexIndexes[j]]++] = i;
+	}
+
 	float getFaceArea(int faceIndex)
 	{
 		ModelFace* face = &faces[faceIndex];
@@ -137,11 +173,12 @@ struct ObjectModel
 		return centroid;
 	}
 
-	vector<glm::vec3> monteCarloSamplePoints(int faceIndex, int count)
+	vector<glm::vec3> monteCarloSamplePoints(int faceIndex, int count, mt19937& generator)
 	{
 		//source: http://www.cs.princeton.edu/~funk/tog02.pdf
 		//section 4.2
 		vector<glm::vec3> result;
+		uniform_real_distribution<double> uniform(0.0, 1.0);
 		
 		if(faces[faceIndex].vertexIndexes.size() == 3) //we have triangles
 		{
@@ -160,8 +197,8 @@ struct ObjectModel
 
 			for(int i=0; i<count; i++)
 			{
-				r1 = static_cast <double> (rand()) / (static_cast <double> (RAND_MAX/1.0));
-				r2 = static_cast <double> (rand()) / (static_cast <double> (RAND_MAX/1.0));
+				r1 = uniform(generator);
+				r2 = uniform(generator);
 				glm::vec3 point(
 						(float)(1.0 - glm::sqrt(r1)) * vertex_a +
 						(float)(glm::sqrt(r1) * (1.0 - r2)) * vertex_b +
@@ -188,8 +225,8 @@ struct ObjectModel
 
 			for(int i=0; i<count/2; i++)
 			{
-				r1 = static_cast <double> (rand()) / (static_cast <double> (RAND_MAX/1.0));
-				r2 = static_cast <double> (rand()) / (static_cast <double> (RAND_MAX/1.0));
+				r1 = uniform(generator);
+				r2 = uniform(generator);
 				glm::vec3 point1(
 					(float)(1.0 - glm::sqrt(r1)) * vertex_a +
 					(float)(glm::sqrt(r1) * (1.0 - r2)) * vertex_b +
@@ -197,8 +234,8 @@ struct ObjectModel
 					);
 				result.push_back(point1);
 
-				r1 = static_cast <double> (rand()) / (static_cast <double> (RAND_MAX/1.0));
-				r2 = static_cast <double> (rand()) / (static_cast <double> (RAND_MAX/1.0));
+				r1 = uniform(generator);
+				r2 = uniform(generator);
 
 				glm::vec3 point2(
 					(float)(1.0 - glm::sqrt(r1)) * vertex_b +
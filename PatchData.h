@@ -9,6 +9,8 @@ struct PatchData {
 	optix::float3 b;
 	optix::float3 c;
 	optix::float3 norm;
+	optix::float3 tangent; // orthonormal frame for the ray directions, from PatchTable
+	optix::float3 bitangent;
 	int id;
 
 };
@@ -0,0 +1,101 @@
+#include "PatchTable.h"
+#include "HemisphereSampling.h"
+
+// tangent is edge with its normal component removed, degenerate edges fall back to the
+// world axis least aligned with the normal
+static void buildTangentFrame(glm::vec3 normal, glm::vec3 edge, glm::vec3& tangent, glm::vec3& bitangent)
+{
+	tangent = edge - glm::dot(edge, normal) * normal;
+	if (glm::dot(tangent, tangent) < 1e-12f)
+	{
+		glm::vec3 axis = fabs(normal.x) < 0.5f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+		tangent = axis - glm::dot(axis, normal) * normal;
+	}
+	tangent = glm::normalize(tangent);
+	bitangent = glm::cross(normal, tangent);
+}
+
+void PatchTable::clear()
+{
+	a.clear(); b.clear(); c.clear(); d.clear();
+	edge1.clear();
+	edge2.clear();
+	normal.clear();
+	tangent.clear();
+	bitangent.clear();
+	centroid.clear();
+	area.clear();
+	reflectance.clear();
+	cornerCount.clear();
+}
+
+void PatchTable::build(vector<RadiosityFace>& faces)
+{
+	clear();
+
+	int patchCount = faces.size();
+	a.resize(patchCount); b.resize(patchCount); c.resize(patchCount); d.resize(patchCount);
+	edge1.resize(patchCount);
+	edge2.resize(patchCount);
+	normal.resize(patchCount);
+	tangent.resize(patchCount);
+	bitangent.resize(patchCount);
+	centroid.resize(patchCount);
+	area.resize(patchCount);
+	reflectance.resize(patchCount);
+	cornerCount.resize(patchCount);
+
+	for (int i = 0; i < patchCount; i++)
+	{
+		ObjectModel* model = faces[i].model;
+		ModelFace* face = &model->faces[faces[i].faceIndex];
+
+		a[i] = model->vertices[face->vertexIndexes[0]];
+		b[i] = model->vertices[face->vertexIndexes[1]];
+		c[i] = model->vertices[face->vertexIndexes[2]];
+		cornerCount[i] = face->vertexIndexes.size() > 3 ? 4 : 3;
+		d[i] = cornerCount[i] == 4 ? model->vertices[face->vertexIndexes[3]] : c[i];
+
+		edge1[i] = b[i] - a[i];
+		edge2[i] = c[i] - a[i];
+		normal[i] = model->getFaceNormal(faces[i].faceIndex);
+		buildTangentFrame(normal[i], edge1[i], tangent[i], bitangent[i]);
+		centroid[i] = model->getFaceCentroid(faces[i].faceIndex);
+		area[i] = model->getFaceArea(faces[i].faceIndex);
+		reflectance[i] = (glm::dvec3)face->material->diffuseColor;
+	}
+}
+
+glm::vec3 PatchTable::samplePoint(int i, float u, float v)
+{
+	//source: http://www.cs.princeton.edu/~funk/tog02.pdf
+	//section 4.2
+	glm::vec3 p0 = a[i], p1 = b[i], p2 = c[i];
+
+	if (cornerCount[i] == 4)
+	{
+		float area_abd = glm::length(glm::cross(b[i] - a[i], d[i] - a[i]));
+		float area_bcd = glm::length(glm::cross(c[i] - b[i], d[i] - b[i]));
+		float fraction = area_abd + area_bcd > 0.0f ? area_abd / (area_abd + area_bcd) : 0.5f;
+		if (u < fraction)
+		{
+			p2 = d[i];
+			u = u / fraction;
+		}
+		else
+		{
+			p0 = b[i];
+			p1 = c[i];
+			p2 = d[i];
+			u = (u - fraction) / (1.0f - fraction);
+		}
+	}
+
+	float r1 = glm::sqrt(glm::min(u, 1.0f));
+	return (1.0f - r1) * p0 + (r1 * (1.0f - v)) * p1 + (v * r1) * p2;
+}
+
+glm::vec3 PatchTable::sampleDirection(int i, float u, float v)
+{
+	return cosineWeightedDirection(u, v, tangent[i], bitangent[i], normal[i]);
+}
@@ -0,0 +1,45 @@
+#ifndef PATCH_TABLE_H
+#define PATCH_TABLE_H
+
+#include "Mesh.h"
+#include "RadiosityFace.h"
+
+#include <vector>
+#include <random>
+
+#include <glm/vec3.hpp>
+#include <glm/glm.hpp>
+
+using namespace std;
+
+// Flat copy of everything the intersection and solver loops read per patch, one
+// array per attribute and indexed like the radiosity scene faces. Built once in
+// loadSceneFacesFromMesh so the hot loops never go through model->faces[]->vertexIndexes[]
+// and model->vertices[] again. Triangles store C in d as well so quads need no special case
+// when only the first three corners are used.
+struct PatchTable
+{
+	vector<glm::vec3> a, b, c, d; // corners, quads are split into ABD and BCD
+	vector<glm::vec3> edge1; // b - a
+	vector<glm::vec3> edge2; // c - a
+	vector<glm::vec3> normal;
+	vector<glm::vec3> tangent, bitangent; // orthonormal with normal, tangent follows edge1
+	vector<glm::vec3> centroid;
+	vector<float> area;
+	vector<glm::dvec3> reflectance; // material diffuse color
+	vector<int> cornerCount; // 3 or 4
+
+	void build(vector<RadiosityFace>& faces);
+	void clear();
+
+	int size() { return area.size(); }
+
+	// maps (u, v) in [0,1)^2 uniformly onto patch i. Quads use u to pick ABD or BCD by area
+	// and rescale it, so stratified or low discrepancy (u, v) stay well spread on the patch.
+	glm::vec3 samplePoint(int i, float u, float v);
+
+	// cosine weighted direction around the normal of patch i from (u, v) in [0,1)^2
+	glm::vec3 sampleDirection(int i, float u, float v);
+};
+
+#endif
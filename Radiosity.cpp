@@ -4,18 +4,25 @@
 #include <optixu/optixpp_namespace.h>
 #include <stdlib.h>
 #include <fstream>
+#include <algorithm>
 #include <math.h>
+#include <time.h>
 #include <sutil.h>
 #include <Eigen/LU>
 #include <Eigen/Dense>
+#include "FormFactorIO.h"
+#include "Sampler.h"
 
 using Eigen::MatrixXd;
+using Eigen::VectorXd;
 
  struct PatchData {
 	optix::float3 a;
 	optix::float3 b;
 	optix::float3 c;
 	optix::float3 norm;
+	optix::float3 tangent; // orthonormal frame for the ray directions, from PatchTable
+	optix::float3 bitangent;
 	int id;
 };
 
@@ -29,7 +36,15 @@ struct test {
 
 #define RADIOSITY_SOLUTION_THRESHOLD		glm::vec3(0.25f, 0.25f, 0.25f)
 #define FORM_FACTOR_SAMPLES					512
-#define DONE_ON_CPU							false // controls which side the form factor computation will be done in
+#define ADAPTIVE_MIN_SAMPLES				64 // first batch of an adaptively sampled row
+#define ADAPTIVE_MAX_SAMPLES				(4 * FORM_FACTOR_SAMPLES) // rays a single adaptive row may use at most
+#define ADAPTIVE_STANDARD_ERROR				0.015 // per entry standard error a row of average weight is sampled down to
+#define PROGRESSIVE_SAMPLE_CHUNK			64 // samples of a shooting row one pool worker draws and traces at a time
+#define ITERATIVE_MAX_ITERATIONS			1000 // sweep cap for Jacobi / Gauss-Seidel when -maxiter is not given
+#define ASYNC_SNAPSHOT_INTERVAL				0.1 // seconds between intermediate snapshots of a background solve
+#define ADAPTIVE_GRADIENT_THRESHOLD			0.1 // largest displayed radiosity step between neighbours before a patch is split
+#define ADAPTIVE_CORNER_INSET				0.1f // shadow test points are pulled this far from the corners towards the centroid
+#define ADAPTIVE_SURFACE_OFFSET				1e-3f // and lifted this much (times the patch size) off the surface
 optix::Context context = 0;
 optix::Buffer vertices, faces, normals;
 optix::Buffer outputFaces, distances;
@@ -37,6 +52,7 @@ optix::Buffer rays;
 optix::Program boundingProgram, intersectionProgram, diffuse_ch;
 
 extern int* main_test(PatchData *patches, int PATCH_NUM, int SAMPLES);
+extern int* main_test_cpu(PatchData *patches, int PATCH_NUM, int SAMPLES);
 
 
 const char* const SAMPLE_NAME = "../../../../Users/PCG DEMO/Desktop/CustomRadiosity - Copy";
@@ -51,6 +67,19 @@ void destroyContext()
 }
 
 
+Radiosity::Radiosity()
+{
+	meanSampleWeight = 0.0;
+	solving = false;
+	cancelRequested = false;
+	snapshotReady = false;
+}
+
+Radiosity::~Radiosity()
+{
+	stopAsyncSolve();
+}
+
 glm::vec2 Radiosity::getTotalCounts(Mesh *mesh) {
 
 	int totalFaces, totalVertices;
@@ -76,7 +105,10 @@ void Radiosity::loadSceneFacesFromMesh(Mesh* mesh)
 {
 	
 	sceneFaces.clear();
+	patches.clear();
 	formFactors.clear();
+	hierarchy.clear();
+	inputFaces.clear();
 
 	int vertexCtr, faceCtr;
 
@@ -109,8 +141,35 @@ void Radiosity::loadSceneFacesFromMesh(Mesh* mesh)
 		}
 	}
 
+	Timer tmr;
+	patches.build(sceneFaces);
+	std::cout << "Building patch table took :" << tmr.elapsed() << endl;
 
-	formFactors.resize(sceneFaces.size(), vector<double>(sceneFaces.size()));
+	if (options.solver == SOLVER_HIERARCHICAL)
+	{
+		// the hierarchy refines the faces as loaded itself, whatever Subdivide did to them
+		vector<RadiosityFace> startingFaces;
+		vector<SceneObject>& startingModel = mesh->getStartingSceneModel();
+		for (int i = 0; i < startingModel.size(); i++)
+		{
+			for (int j = 0; j < startingModel[i].obj_model.faces.size(); j++)
+			{
+				RadiosityFace radiosityFace;
+				radiosityFace.model = &startingModel[i].obj_model;
+				radiosityFace.faceIndex = j;
+				startingFaces.push_back(radiosityFace);
+			}
+		}
+		inputFaces.build(startingFaces);
+	}
+
+	tmr.reset();
+	bvh.build(patches);
+	std::cout << "Building BVH (" << bvh.getNodeCount() << " nodes) took :" << tmr.elapsed() << endl;
+
+	tmr.reset();
+	grid.build(patches);
+	std::cout << "Building visibility grid (" << grid.getCellCount() << " cells, " << grid.getReferenceCount() << " triangle references) took :" << tmr.elapsed() << endl;
 }
 
 int Radiosity::getMaxUnshotRadiosityFaceIndex()
@@ -121,7 +180,7 @@ int Radiosity::getMaxUnshotRadiosityFaceIndex()
 	for (int i = 0; i<sceneFaces.size(); i++)
 	{
 		double curUnshot = glm::length(sceneFaces[i].unshotRadiosity);
-		double curArea = sceneFaces[i].model->getFaceArea(sceneFaces[i].faceIndex);
+		double curArea = patches.area[i];
 
 		curUnshot *= curArea;
 
@@ -136,25 +195,6 @@ int Radiosity::getMaxUnshotRadiosityFaceIndex()
 }
 
 
-glm::vec3 getCosineDistributionVector(glm::vec3 a, glm::vec3 b, glm::vec3 c, glm::vec3 norm) {
-	float sin_theta = sqrt((double)rand() / ((double)RAND_MAX + 1));
-	float cos_theta = sqrt(1 - sin_theta * sin_theta);
-
-	float psi = ((double)rand() / ((double)RAND_MAX + 1) * 2 * 3.14159265359);
-
-	glm::vec3 a1 = glm::vec3(sin_theta) * cos(psi);
-	glm::vec3 b1 = glm::vec3(sin_theta) * sin(psi);
-	glm::vec3 c1 = glm::vec3(cos_theta);
-
-
-	glm::vec3 v1 = a1 * (a - b);
-	glm::vec3 v2 = b1 * (a - c);
-	glm::vec3 v3 = c1 * norm;
-
-	return v1 + v2 + v3;
-}
-
-
 optix::Buffer getOutputBuffer()
 {
 	return context["output_buffer"]->getBuffer();
@@ -176,46 +216,168 @@ float* prepareFF(std::vector<std::vector<double>> h, int size) {
 	return ptr;
 }
 
-void Radiosity::calculateFormFactorsForFace(int i, int samplePointsCount)
+void Radiosity::traceSampleRays(int i, glm::vec4* samples, int count, int* hits)
 {
-	// Formfactor computation CPU side 
-	vector<Ray> generated_dir(samplePointsCount);
+	// x, y place the ray origin on the patch, z, w pick its direction
+	for (int j = 0; j < count; j++) {
+		glm::vec3 origin = patches.samplePoint(i, samples[j].x, samples[j].y);
+		glm::vec3 direction = patches.sampleDirection(i, samples[j].z, samples[j].w);
 
-	vector<glm::vec3> samplePoints_i = sceneFaces[i].model->monteCarloSamplePoints(sceneFaces[i].faceIndex, samplePointsCount);
+		int k;
+		float distance;
+		glm::vec3 HitPoint;
+		hits[j] = isVisibleFrom(Ray(origin, direction), k, distance, HitPoint) ? k : -1;
+	}
+}
 
-	glm::vec3 normal_i = sceneFaces[i].model->getFaceNormal(sceneFaces[i].faceIndex);
+void Radiosity::sampleRays(int i, int first, int count, glm::vec4 rotation, mt19937& generator, bool parallel, glm::vec4* samples, int* hits)
+{
+	if (!parallel)
+	{
+		generateSampleRange(options.sampleSequence, first, count, rotation, generator, samples);
+		traceSampleRays(i, samples, count, hits);
+		return;
+	}
 
+	// one row on its own: split its samples into chunks, each drawn with the generator of the
+	// worker tracing it. Stratified chunks are stratified on their own like adaptive batches
+	int chunks = (count + PROGRESSIVE_SAMPLE_CHUNK - 1) / PROGRESSIVE_SAMPLE_CHUNK;
+	threadPool.parallelFor(chunks, [&](int c, int threadIndex) {
+		int start = c * PROGRESSIVE_SAMPLE_CHUNK;
+		int chunkCount = glm::min(PROGRESSIVE_SAMPLE_CHUNK, count - start);
+		generateSampleRange(options.sampleSequence, first + start, chunkCount, rotation, threadGenerators[threadIndex], samples + start);
+		traceSampleRays(i, samples + start, chunkCount, hits + start);
+	});
+}
 
-	int v0_k_index = sceneFaces[i].model->faces[sceneFaces[i].faceIndex].vertexIndexes[0];
-	int v1_k_index = sceneFaces[i].model->faces[sceneFaces[i].faceIndex].vertexIndexes[1];
-	int v2_k_index = sceneFaces[i].model->faces[sceneFaces[i].faceIndex].vertexIndexes[2];
+int Radiosity::calculateFormFactorsForFace(int i, int samplePointsCount, mt19937& generator, FormFactorRow& formFactorRow, bool parallel)
+{
+	// Formfactor computation CPU side, builds the sparse row F_i* from the patches the rays hit
+	if (options.adaptiveSampling)
+		return calculateFormFactorsAdaptive(i, generator, formFactorRow, parallel);
 
-	glm::vec3 A = sceneFaces[i].model->vertices[v0_k_index];
-	glm::vec3 B = sceneFaces[i].model->vertices[v1_k_index];
-	glm::vec3 C = sceneFaces[i].model->vertices[v2_k_index];
+	vector<glm::vec4> samples(samplePointsCount);
+	vector<int> hits(samplePointsCount, -1);
 
+	sampleRays(i, 0, samplePointsCount, randomRotation(generator), generator, parallel, &samples[0], &hits[0]);
 
-	//We generate a ray and direction based on the various different locations on the face
-	for (int j = 0; j < samplePointsCount; j++) {
+	formFactorRow.buildFromHits(&hits[0], samplePointsCount, (double)(1.0 / samplePointsCount));
+	return samplePointsCount;
+}
 
-		glm::vec3 direction = (getCosineDistributionVector(A, B, C, normal_i));
+void Radiosity::prepareSampleWeights()
+{
+	double total = 0.0;
+	for (int i = 0; i < sceneFaces.size(); i++)
+		total += getSampleWeight(i);
+	meanSampleWeight = sceneFaces.empty() ? 0.0 : total / sceneFaces.size();
+}
 
-		generated_dir[j] = Ray(samplePoints_i[j], (direction));
+double Radiosity::getSampleWeight(int i)
+{
+	// how much energy leaves through row i: the patch area times what it reflects or emits
+	glm::dvec3 reflectance = patches.reflectance[i];
+	glm::dvec3 emission = sceneFaces[i].emission;
+	double strength = glm::max(glm::max(reflectance.x, glm::max(reflectance.y, reflectance.z)), glm::max(emission.x, glm::max(emission.y, emission.z)));
+	return patches.area[i] * strength;
+}
 
-	}
-	for (int j = 0; j < samplePointsCount; j++) {
-		int k;
-		float  distance;
-		glm::vec3 HitPoint;
-		if (isVisibleFrom(generated_dir[j], k, distance, HitPoint)) {
+int Radiosity::calculateFormFactorsAdaptive(int i, mt19937& generator, FormFactorRow& formFactorRow, bool parallel)
+{
+	// Rays are shot in doubling batches until the standard error sqrt(F(1-F)/n) of every entry is
+	// below ADAPTIVE_STANDARD_ERROR. The bound scales with sqrt(mean weight / weight), so the
+	// rays spent on a row end up roughly proportional to the energy it carries.
+	double weight = getSampleWeight(i);
+	double targetError = weight > 0.0 ? ADAPTIVE_STANDARD_ERROR * glm::sqrt(meanSampleWeight / weight) : 1.0;
+
+	vector<glm::vec4> samples(ADAPTIVE_MAX_SAMPLES);
+	vector<int> hits(ADAPTIVE_MAX_SAMPLES, -1);
+	glm::vec4 rotation = randomRotation(generator);
+
+	int count = 0;
+	int batch = ADAPTIVE_MIN_SAMPLES;
+	while (true)
+	{
+		sampleRays(i, count, batch, rotation, generator, parallel, &samples[count], &hits[count]);
+		count += batch;
 
-			formFactors[i][k] += (double)(1.0 / samplePointsCount);
+		formFactorRow.buildFromHits(&hits[0], count, (double)(1.0 / count));
+		if (count >= ADAPTIVE_MAX_SAMPLES)
+			break;
 
+		double largestError = 0.0;
+		for (int k = 0; k < formFactorRow.values.size(); k++)
+		{
+			double F = formFactorRow.values[k];
+			largestError = glm::max(largestError, glm::sqrt(F * (1.0 - F) / count));
 		}
+		if (largestError < targetError)
+			break;
 
+		batch = glm::min(count, ADAPTIVE_MAX_SAMPLES - count);
+	}
+	return count;
+}
+
+void Radiosity::prepareThreadGenerators()
+{
+	if (threadGenerators.size() == threadPool.getThreadCount())
+		return;
 
+	unsigned int seed = (unsigned int)time(NULL);
+	threadGenerators.clear();
+	for (int t = 0; t < threadPool.getThreadCount(); t++)
+	{
+		seed_seq sequence{ seed, (unsigned int)t };
+		threadGenerators.push_back(mt19937(sequence));
 	}
+}
+
+void Radiosity::calculateFormFactorsOnCPU(int samplePointsCount, vector<int>& rays)
+{
+	prepareThreadGenerators();
 
+	if (options.adaptiveSampling)
+		prepareSampleWeights();
+
+	// every shooter patch owns its row, so workers never write the same memory
+	vector<FormFactorRow> rows(sceneFaces.size());
+	rays.assign(sceneFaces.size(), 0);
+	threadPool.parallelFor(sceneFaces.size(), [&](int i, int threadIndex) {
+		rays[i] = calculateFormFactorsForFace(i, samplePointsCount, threadGenerators[threadIndex], rows[i]);
+	});
+
+	formFactors.build(rows);
+
+	double totalRays = 0.0;
+	for (int i = 0; i < rays.size(); i++)
+		totalRays += rays[i];
+	printf("Traced %.0f rays, %.1f per patch\n", totalRays, rays.empty() ? 0.0 : totalRays / rays.size());
+}
+
+unsigned long long Radiosity::getGeometryHash(int samplePointsCount)
+{
+	// only what the form factors depend on: patch count, sample count, sampling options and patch corners.
+	// materials and emission are left out so changing them keeps the cache valid
+	int patchCount = sceneFaces.size();
+	unsigned long long hash = hashBytes(&patchCount, sizeof(patchCount));
+	hash = hashBytes(&samplePointsCount, sizeof(samplePointsCount), hash);
+	// only the CPU BVH backend draws from the sample sequence, random keeps the original keys
+	if (options.backend == BACKEND_CPU_BVH && options.sampleSequence != SAMPLES_RANDOM)
+		hash = hashBytes(&options.sampleSequence, sizeof(options.sampleSequence), hash);
+	if (options.reciprocity != RECIPROCITY_OFF)
+		hash = hashBytes(&options.reciprocity, sizeof(options.reciprocity), hash);
+
+	for (int i = 0; i < patchCount; i++)
+	{
+		int vertexCount = patches.cornerCount[i];
+		hash = hashBytes(&vertexCount, sizeof(vertexCount), hash);
+
+		glm::vec3 corners[4] = { patches.a[i], patches.b[i], patches.c[i], patches.d[i] };
+		for (int v = 0; v < vertexCount; v++)
+			hash = hashBytes(&corners[v].x, 3 * sizeof(float), hash);
+	}
+	return hash;
 }
 
 void Radiosity::PrepareUnshotRadiosityValues()
@@ -227,127 +389,341 @@ void Radiosity::PrepareUnshotRadiosityValues()
 	}
 }
 
+void Radiosity::solveProgressive()
+{
+	// Progressive refinement: keep only one row of form factors alive and shoot the
+	// unshot radiosity of the patch holding the most unshot energy until little is left
+	FormFactorRow formFactorRow;
+
+	prepareThreadGenerators();
+	PrepareUnshotRadiosityValues();
+	if (options.adaptiveSampling)
+		prepareSampleWeights();
+
+	// getMaxUnshotRadiosityFaceIndex ranks by unshot energy |unshot| * area, so stop on the same
+	// measure: once the largest unshot energy left is below toleranceScale of all emitted energy
+	glm::dvec3 emitted(0.0);
+	for (int i = 0; i < sceneFaces.size(); i++)
+		emitted += sceneFaces[i].emission * (double)patches.area[i];
+	double energyTolerance = glm::length(emitted) * options.toleranceScale;
+
+	Timer tmr;
+	int shots = 0;
+	while (options.maxIterations <= 0 || shots < options.maxIterations)
+	{
+		if (cancelRequested)
+			break;
+
+		int i = getMaxUnshotRadiosityFaceIndex();
+		if (i == -1)
+			break;
+
+		glm::dvec3 unshot = sceneFaces[i].unshotRadiosity;
+		if (glm::length(unshot) * patches.area[i] < energyTolerance)
+			break;
+
+		// a single row per shot, so its rays are spread over the pool instead of the rows
+		calculateFormFactorsForFace(i, FORM_FACTOR_SAMPLES, threadGenerators[0], formFactorRow, true);
+
+		double area_i = patches.area[i];
+
+		for (int k = 0; k < formFactorRow.columns.size(); k++)
+		{
+			int j = formFactorRow.columns[k];
+			if (j == i)
+				continue;
+
+			// reciprocity: F_ji = F_ij * A_i / A_j
+			double area_j = patches.area[j];
+			glm::dvec3 delta_rad = patches.reflectance[j] * unshot * (formFactorRow.values[k] * area_i / area_j);
+
+			sceneFaces[j].totalRadiosity += delta_rad;
+			sceneFaces[j].unshotRadiosity += delta_rad;
+		}
+
+		sceneFaces[i].unshotRadiosity = glm::dvec3(0.0, 0.0, 0.0);
+		shots++;
+
+		publishSnapshot(false);
+	}
+
+	std::cout << "Progressive refinement took " << shots << " shots and :" << tmr.elapsed() << endl;
+}
+
+void Radiosity::solveIterative(vector<glm::dvec3>& reflectance, bool gaussSeidel)
+{
+	// Gathering iterations on B = E + RFB, working on the sparse form factor rows directly
+	int patchCount = sceneFaces.size();
+	int maxIterations = options.maxIterations > 0 ? options.maxIterations : ITERATIVE_MAX_ITERATIONS;
+	glm::dvec3 tolerance = (glm::dvec3)RADIOSITY_SOLUTION_THRESHOLD * options.toleranceScale;
+
+	vector<glm::dvec3> radiosity(patchCount);
+	for (int i = 0; i < patchCount; i++)
+		radiosity[i] = sceneFaces[i].emission;
+
+	// Jacobi gathers from the previous iterate, Gauss-Seidel from the one being updated
+	vector<glm::dvec3> previous;
+
+	Timer tmr;
+	int iteration;
+	for (iteration = 0; iteration < maxIterations && !cancelRequested; iteration++)
+	{
+		glm::dvec3 residual(0.0, 0.0, 0.0);
+
+		if (!gaussSeidel)
+			previous = radiosity;
+		vector<glm::dvec3>& source = gaussSeidel ? radiosity : previous;
+
+		for (int i = 0; i < patchCount; i++)
+		{
+			glm::dvec3 gathered(0.0, 0.0, 0.0);
+			double F_ii = 0.0;
+
+			for (int k = formFactors.rowOffsets[i]; k < formFactors.rowOffsets[i + 1]; k++)
+			{
+				int j = formFactors.columns[k];
+				if (j == i)
+					F_ii = formFactors.values[k];
+				else
+					gathered += formFactors.values[k] * source[j];
+			}
+
+			// the F_ii term is moved to the left hand side
+			glm::dvec3 next = (sceneFaces[i].emission + reflectance[i] * gathered) / (glm::dvec3(1.0) - reflectance[i] * F_ii);
+			glm::dvec3 change = glm::abs(next - radiosity[i]);
+
+			residual = glm::max(residual, change);
+			radiosity[i] = next;
+		}
+
+		printf("%s iteration %d residual: %f %f %f\n", gaussSeidel ? "Gauss-Seidel" : "Jacobi", iteration, residual.x, residual.y, residual.z);
+
+		if (solving)
+		{
+			for (int i = 0; i < patchCount; i++)
+				sceneFaces[i].totalRadiosity = radiosity[i];
+			publishSnapshot(false);
+		}
+
+		if (residual.x < tolerance.x && residual.y < tolerance.y && residual.z < tolerance.z)
+		{
+			iteration++;
+			break;
+		}
+	}
+
+	std::cout << "Iterative solve took " << iteration << " iterations and :" << tmr.elapsed() << endl;
+
+	for (int i = 0; i < patchCount; i++)
+		sceneFaces[i].totalRadiosity = radiosity[i];
+}
+
+void Radiosity::solveHierarchical()
+{
+	// the links only depend on the geometry, a re-solve of the same scene reuses them
+	if (hierarchy.getNodeCount() == 0)
+	{
+		prepareThreadGenerators();
+
+		Timer tmr;
+		hierarchy.build(inputFaces, patches, grid, threadPool, threadGenerators);
+		double leaves = hierarchy.getLeafCount();
+		std::cout << "Hierarchical refinement: " << hierarchy.getNodeCount() << " nodes, " << leaves << " leaves and "
+			<< hierarchy.getLinkCount() << " links (" << leaves * leaves << " leaf pairs) took :" << tmr.elapsed() << endl;
+	}
+
+	int patchCount = sceneFaces.size();
+	int maxIterations = options.maxIterations > 0 ? options.maxIterations : ITERATIVE_MAX_ITERATIONS;
+	glm::dvec3 tolerance = (glm::dvec3)RADIOSITY_SOLUTION_THRESHOLD * options.toleranceScale;
+
+	vector<glm::dvec3> emission(patchCount);
+	for (int i = 0; i < patchCount; i++)
+		emission[i] = sceneFaces[i].emission;
+
+	Timer tmr;
+	int iteration;
+	for (iteration = 0; iteration < maxIterations && !cancelRequested; iteration++)
+	{
+		glm::dvec3 change = hierarchy.iterate(emission, patches.reflectance, threadPool);
+		printf("Hierarchical iteration %d change: %f %f %f\n", iteration, change.x, change.y, change.z);
+
+		if (solving)
+		{
+			for (int i = 0; i < patchCount; i++)
+				sceneFaces[i].totalRadiosity = hierarchy.getPatchRadiosity(i);
+			publishSnapshot(false);
+		}
+
+		if (change.x < tolerance.x && change.y < tolerance.y && change.z < tolerance.z)
+		{
+			iteration++;
+			break;
+		}
+	}
+
+	std::cout << "Hierarchical solve took " << iteration << " iterations and :" << tmr.elapsed() << endl;
+
+	for (int i = 0; i < patchCount; i++)
+		sceneFaces[i].totalRadiosity = hierarchy.getPatchRadiosity(i);
+}
+
 void Radiosity::calculateRadiosityValues()
 	{
-		//USED for RGB matrix calculation and inversion on the CPU side 
-		MatrixXd A = MatrixXd::Zero(sceneFaces.size(), sceneFaces.size());
-		MatrixXd I = MatrixXd::Identity(sceneFaces.size(), sceneFaces.size()); // creates an identity matrix for visualization
-		MatrixXd A_r = MatrixXd::Ones(sceneFaces.size(), sceneFaces.size());
-		MatrixXd A_g = MatrixXd::Ones(sceneFaces.size(), sceneFaces.size());
-		MatrixXd A_b = MatrixXd::Ones(sceneFaces.size(), sceneFaces.size());
+		if (options.solver == SOLVER_PROGRESSIVE)
+		{
+			solveProgressive();
+			return;
+		}
 
-		MatrixXd R = MatrixXd::Zero(sceneFaces.size(), sceneFaces.size());
-		MatrixXd G = MatrixXd::Zero(sceneFaces.size(), sceneFaces.size());
-		MatrixXd B = MatrixXd::Zero(sceneFaces.size(), sceneFaces.size());
+		if (options.solver == SOLVER_HIERARCHICAL)
+		{
+			solveHierarchical();
+			return;
+		}
+
+		// the GPU kernel is laid out for FORM_FACTOR_SAMPLES rays per patch, only the CPU backends shoot fewer
+		int samplePointsCount = FORM_FACTOR_SAMPLES;
+		if (options.reciprocity == RECIPROCITY_HALF && options.backend != BACKEND_GPU)
+			samplePointsCount = FORM_FACTOR_SAMPLES / 2;
+		vector<int> rays(sceneFaces.size(), samplePointsCount);
 
-			
 		Timer tmr;
-		if (DONE_ON_CPU) {
+		bool cacheHit = false;
+		unsigned long long geometryHash = 0;
+		string cachePath;
+		if (!options.formFactorCacheDir.empty()) {
+			// adaptive rows have no fixed sample count, keep them apart from the fixed ones.
+			// Only the CPU BVH backend samples adaptively, the others always shoot samplePointsCount
+			bool adaptive = options.adaptiveSampling && options.backend == BACKEND_CPU_BVH;
+			geometryHash = getGeometryHash(adaptive ? -1 : samplePointsCount);
+			cachePath = formFactorCachePath(options.formFactorCacheDir, geometryHash);
+			cacheHit = loadFormFactorCache(cachePath, geometryHash, formFactors) && formFactors.getRowCount() == sceneFaces.size();
+			if (cacheHit)
+				std::cout << "Loading Form Factors from cache " << cachePath << " took :" << tmr.elapsed() << endl;
+		}
+
+		if (cacheHit) {
+			// skip ray casting entirely, the geometry has not changed
+		}
+		else if (options.backend == BACKEND_CPU_BVH) {
 			tmr.reset();
 			
 			// populates the form factor matrix with proper values
-			for (int j = 0; j < sceneFaces.size(); j++)
-			{
-				calculateFormFactorsForFace(j, FORM_FACTOR_SAMPLES);
-
-			}
-			std::cout << "Calculating Form Factors on the CPU took :" << tmr.elapsed() << endl;
-		
-			for (int i = 0; i < sceneFaces.size(); i++) {
-				float sum = 0;
-				for (int j = 0; j < sceneFaces.size(); j++)
-				{
-					sum += formFactors[i][j];
-					A(i, j) = formFactors[i][j];
-				}
-
-				//std::cout << "Percent of ray's that hit: " << (sum*100.0) << std::endl;
-			}
-		
+			calculateFormFactorsOnCPU(samplePointsCount, rays);
+			std::cout << "Calculating Form Factors on the CPU (" << threadPool.getThreadCount() << " threads) took :" << tmr.elapsed() << endl;
 		
 		}
 		else {
-			PatchData *patches = (PatchData*)malloc(sceneFaces.size() * sizeof(PatchData));
+			PatchData *patchData = (PatchData*)malloc(sceneFaces.size() * sizeof(PatchData));
 			for (int i = sceneFaces.size()-1; i >= 0; i--)
 			{
-				PatchData *t = (PatchData*)malloc(sizeof(PatchData));
+				PatchData t;
 				// loops through each patch a populates our patch data structure
-				int v0_k_index = sceneFaces[i].model->faces[sceneFaces[i].faceIndex].vertexIndexes[0];
-				int v1_k_index = sceneFaces[i].model->faces[sceneFaces[i].faceIndex].vertexIndexes[1];
-				int v2_k_index = sceneFaces[i].model->faces[sceneFaces[i].faceIndex].vertexIndexes[2];
-
-				glm::vec3 A = sceneFaces[i].model->vertices[v0_k_index];
-				glm::vec3 B = sceneFaces[i].model->vertices[v1_k_index];
-				glm::vec3 C = sceneFaces[i].model->vertices[v2_k_index];
-				glm::vec3 norm = sceneFaces[i].model->getFaceNormal(sceneFaces[i].faceIndex);
-
-				t->a = optix::make_float3(A.x, A.y ,A.z);
-				t->b = optix::make_float3(B.x, B.y, B.z);
-				t->c = optix::make_float3(C.x, C.y, C.z);
-				t->norm = optix::make_float3(norm.x, norm.y, norm.z);
-				t->id = i;
-				patches[i] = *t;
+				glm::vec3 A = patches.a[i];
+				glm::vec3 B = patches.b[i];
+				glm::vec3 C = patches.c[i];
+				glm::vec3 norm = patches.normal[i];
+				glm::vec3 tangent = patches.tangent[i];
+				glm::vec3 bitangent = patches.bitangent[i];
+
+				t.a = optix::make_float3(A.x, A.y ,A.z);
+				t.b = optix::make_float3(B.x, B.y, B.z);
+				t.c = optix::make_float3(C.x, C.y, C.z);
+				t.norm = optix::make_float3(norm.x, norm.y, norm.z);
+				t.tangent = optix::make_float3(tangent.x, tangent.y, tangent.z);
+				t.bitangent = optix::make_float3(bitangent.x, bitangent.y, bitangent.z);
+				t.id = i;
+				patchData[i] = t;
 			}
 
 			tmr.reset();
-			int* out = main_test(patches, sceneFaces.size(), FORM_FACTOR_SAMPLES);
-			printf("scenes %d", sceneFaces.size());
-			std::cout << "Calculating Form Factors on the GPU took :" << tmr.elapsed() << endl;
-
-			// Decodes the updated form factor matrix
-			for (int i = 0; i < sceneFaces.size(); i++) {
-				for (int j = 0; j < FORM_FACTOR_SAMPLES; j++) {
-				
-					int temp = out[i*FORM_FACTOR_SAMPLES + j];
-					/*if (temp == 0) {
-						std::cout << "value is : " << temp << std::endl;
-					}*/
-					//std::cout << 
-					if (temp != -1) {
-						A(i, temp) += 1.0 / (float)(FORM_FACTOR_SAMPLES);
-					
-					}
-				
-				
-				}
-				//std::cout << "Row " << i <<" sum " << A.row(i).sum() << endl;
-			
+			int* out;
+			if (options.backend == BACKEND_CPU_SIMD) {
+				out = main_test_cpu(patchData, sceneFaces.size(), samplePointsCount);
+				std::cout << "Calculating Form Factors on the CPU (SIMD) took :" << tmr.elapsed() << endl;
 			}
-			free(patches);
+			else {
+				out = main_test(patchData, sceneFaces.size(), FORM_FACTOR_SAMPLES);
+				printf("scenes %d", sceneFaces.size());
+				std::cout << "Calculating Form Factors on the GPU took :" << tmr.elapsed() << endl;
+			}
+
+			// Decodes the hit buffer straight into the sparse form factor rows
+			vector<FormFactorRow> rows(sceneFaces.size());
+			threadPool.parallelFor(sceneFaces.size(), [&](int i, int) {
+				rows[i].buildFromHits(&out[i*samplePointsCount], samplePointsCount, 1.0 / (float)(samplePointsCount));
+			});
+			formFactors.build(rows);
+
+			free(patchData);
 			free(out);
+		}
 
-			std::ofstream file("test.csv"); 
-			if (file.is_open())
-			{
-				//Matrix m = Matrix::Random(30, 3);
-				//file << "Here is the matrix m:\n" << A << '\n';
-				for (int i = 0; i < A.rows(); i++) {
-					for (int j = 0; j < A.cols(); j++) {
-						string str = (std::to_string)(A(i, j));
-						if (j + 1 == A.cols()) {
-							file << str;
-						}
-						else {
-							file << str << ',';
-						}
-					}
-					file << '\n';
-				}
-			}
+		if (!cacheHit && options.reciprocity != RECIPROCITY_OFF) {
+			tmr.reset();
+			formFactors.combineReciprocal(patches.area, rays);
+			std::cout << "Combining reciprocal form factors took :" << tmr.elapsed() << endl;
+		}
+
+		if (!cacheHit && !cachePath.empty() && saveFormFactorCache(cachePath, geometryHash, formFactors))
+			std::cout << "Form factors cached in " << cachePath << endl;
+
+		if (options.formFactorExportFormat != EXPORT_NONE && exportFormFactors(options.formFactorExportFile, formFactors, options.formFactorExportFormat))
+			std::cout << "Form factors exported to " << options.formFactorExportFile << endl;
+
+		std::cout << "Form factor matrix has " << formFactors.getNonZeroCount() << " nonzeros for " << sceneFaces.size() << " patches" << endl;
+
+		if (options.solver == SOLVER_JACOBI || options.solver == SOLVER_GAUSS_SEIDEL)
+		{
+			solveIterative(patches.reflectance, options.solver == SOLVER_GAUSS_SEIDEL);
+			return;
 		}
 
+		// the direct solvers need the dense matrix
+		MatrixXd A = formFactors.toDense();
+
+		// reflectance diagonals, kept as vectors so I - RF costs O(N^2) instead of a dense product
+		VectorXd R = VectorXd::Zero(sceneFaces.size());
+		VectorXd G = VectorXd::Zero(sceneFaces.size());
+		VectorXd B = VectorXd::Zero(sceneFaces.size());
+
 		for (int i = 0; i < sceneFaces.size(); i++) {
-			// this grabs and puplates the emission value diagonals
-			glm::vec3 emission = sceneFaces[i].model->faces[sceneFaces[i].faceIndex].material->diffuseColor;
-			R(i, i) = emission.x;
-			G(i, i) = emission.y;
-			B(i, i) = emission.z;
+			// this grabs and puplates the reflectance value diagonals
+			R(i) = patches.reflectance[i].x;
+			G(i) = patches.reflectance[i].y;
+			B(i) = patches.reflectance[i].z;
 
 		}
 
-		A_r = I - (R *A);
-		A_b = I - (B * A);
-		A_g = I - (G *A);
+		MatrixXd A_r = -(R.asDiagonal() * A);
+		MatrixXd A_g = -(G.asDiagonal() * A);
+		MatrixXd A_b = -(B.asDiagonal() * A);
+		A_r.diagonal().array() += 1.0;
+		A_g.diagonal().array() += 1.0;
+		A_b.diagonal().array() += 1.0;
+
+		if (options.solver == SOLVER_LU)
+		{
+			// only the solution vector is needed: factorize each channel once and solve for its emission
+			VectorXd E_r(sceneFaces.size());
+			VectorXd E_g(sceneFaces.size());
+			VectorXd E_b(sceneFaces.size());
+			for (int i = 0; i < sceneFaces.size(); i++) {
+				E_r(i) = sceneFaces[i].emission.x;
+				E_g(i) = sceneFaces[i].emission.y;
+				E_b(i) = sceneFaces[i].emission.z;
+			}
+
+			tmr.reset();
+			VectorXd B_r = A_r.partialPivLu().solve(E_r);
+			VectorXd B_g = A_g.partialPivLu().solve(E_g);
+			VectorXd B_b = A_b.partialPivLu().solve(E_b);
+			std::cout << "Matrix inversions took (LU solve): " << tmr.elapsed() << endl;
+
+			for (int i = 0; i < sceneFaces.size(); i++)
+				sceneFaces[i].totalRadiosity = glm::dvec3(B_r(i), B_g(i), B_b(i));
+			return;
+		}
 
 		tmr.reset();
 		A_r = A_r.inverse();
@@ -382,208 +758,226 @@ void Radiosity::calculateRadiosityValues()
 
 }
 
-void Radiosity::setMeshFaceColors()
+bool Radiosity::startAsyncSolve()
 {
-	for (int i = 0; i< sceneFaces.size(); i++)
-	{
-		glm::dvec3 radValue = glm::clamp(sceneFaces[i].totalRadiosity, 0.0, 1.0);
-
-		glm::clamp(radValue, 0.0, 1.0);
-		sceneFaces[i].model->faces[sceneFaces[i].faceIndex].intensity = radValue;
-	}
+	if (solving)
+		return false;
+	if (solverThread.joinable())
+		solverThread.join();
+
+	solving = true;
+	cancelRequested = false;
+	snapshotTimer.reset();
+	solverThread = thread([this]() {
+		calculateRadiosityValues();
+		publishSnapshot(true);
+		solving = false;
+	});
+	return true;
 }
 
-bool Radiosity::isParallelToFace(Ray* r, int i)
+void Radiosity::stopAsyncSolve()
 {
-	glm::vec3 n = sceneFaces[i].model->getFaceNormal(sceneFaces[i].faceIndex);
-	float dotProduct = abs(glm::dot(n, r->getDirection()));
-	if (dotProduct <= 0.001f)
-		return true;
-	return false;
+	cancelRequested = true;
+	if (solverThread.joinable())
+		solverThread.join();
+	cancelRequested = false;
 }
 
-struct RayHit
+// solver thread only, does nothing for blocking solves
+void Radiosity::publishSnapshot(bool force)
 {
-	float distance;
-	int hitSceneFaceIndex;
-	glm::vec3 hitpoint;
-};
+	if (!solving)
+		return;
+	if (!force && snapshotTimer.elapsed() < ASYNC_SNAPSHOT_INTERVAL)
+		return;
+	snapshotTimer.reset();
+
+	backSnapshot.resize(sceneFaces.size());
+	for (int i = 0; i < sceneFaces.size(); i++)
+		backSnapshot[i] = sceneFaces[i].totalRadiosity;
+
+	lock_guard<mutex> lock(snapshotMutex);
+	backSnapshot.swap(frontSnapshot);
+	snapshotReady = true;
+}
 
-bool rayHit_LessThan(RayHit r1, RayHit r2)
+bool Radiosity::applySnapshotToMesh()
 {
-	if (r1.distance < r2.distance)
-		return true;
-	return false;
+	lock_guard<mutex> lock(snapshotMutex);
+	if (!snapshotReady)
+		return false;
+
+	for (int i = 0; i < frontSnapshot.size() && i < sceneFaces.size(); i++)
+		sceneFaces[i].model->faces[sceneFaces[i].faceIndex].intensity = glm::clamp(frontSnapshot[i], 0.0, 1.0);
+
+	snapshotReady = false;
+	return true;
 }
 
-bool Radiosity::isVisibleFrom(int i, int j)
+void Radiosity::setMeshFaceColors()
 {
+	for (int i = 0; i< sceneFaces.size(); i++)
+	{
+		glm::dvec3 radValue = glm::clamp(sceneFaces[i].totalRadiosity, 0.0, 1.0);
 
-	vector<RayHit> rayHits;
-
-	//get both centroids
-	glm::vec3 centroid_i = sceneFaces[i].model->getFaceCentroid(sceneFaces[i].faceIndex);
-	glm::vec3 centroid_j = sceneFaces[j].model->getFaceCentroid(sceneFaces[j].faceIndex);
+		glm::clamp(radValue, 0.0, 1.0);
+		sceneFaces[i].model->faces[sceneFaces[i].faceIndex].intensity = radValue;
+	}
+}
 
-	//now make a ray
-	Ray ray(centroid_i, centroid_j - centroid_i);
+bool Radiosity::isOnShadowBoundary(int i, vector<int>& emitters)
+{
+	glm::vec3 corners[4] = { patches.a[i], patches.b[i], patches.c[i], patches.d[i] };
+	glm::vec3 lift = patches.normal[i] * (ADAPTIVE_SURFACE_OFFSET * glm::sqrt(patches.area[i]));
 
-	for (int k = 0; k<sceneFaces.size(); k++)
+	for (int e = 0; e < emitters.size(); e++)
 	{
-		if (k == i)
-			continue;
+		int emitter = emitters[e];
+		glm::vec3 target = patches.centroid[emitter];
+		int visibleCorners = 0;
 
-		int v0_k_index = sceneFaces[k].model->faces[sceneFaces[k].faceIndex].vertexIndexes[0];
-		int v1_k_index = sceneFaces[k].model->faces[sceneFaces[k].faceIndex].vertexIndexes[1];
-		int v2_k_index = sceneFaces[k].model->faces[sceneFaces[k].faceIndex].vertexIndexes[2];
+		for (int k = 0; k < patches.cornerCount[i]; k++)
+		{
+			glm::vec3 point = corners[k] + ADAPTIVE_CORNER_INSET * (patches.centroid[i] - corners[k]) + lift;
+			glm::vec3 toEmitter = target - point;
 
-		glm::vec3 A = sceneFaces[k].model->vertices[v0_k_index];
-		glm::vec3 B = sceneFaces[k].model->vertices[v1_k_index];
-		glm::vec3 C = sceneFaces[k].model->vertices[v2_k_index];
+			//facing away counts as shadowed, the terminator is a boundary as well
+			if (glm::dot(patches.normal[i], toEmitter) <= 0.0f || glm::dot(patches.normal[emitter], toEmitter) >= 0.0f)
+				continue;
 
-		glm::vec3 hitPoint;
-		if (glm::intersectRayTriangle(centroid_i, centroid_j - centroid_i, A, B, C, hitPoint))
-		{
-			RayHit currentHit;
-			currentHit.distance = glm::distance(ray.getStart(), hitPoint);
-			currentHit.hitSceneFaceIndex = k;
-			rayHits.push_back(currentHit);
-		}
-		/*
-		if(doesRayHit(&ray, k, hitPoint))
-		{
-		RayHit currentHit;
-		currentHit.distance = glm::distance(ray.getStart(), hitPoint);
-		currentHit.hitSceneFaceIndex = k;
-		rayHits.push_back(currentHit);
+			if (!grid.isOccluded(point, target, i, emitter))
+				visibleCorners++;
 		}
-		*/
-	}
-	if (rayHits.empty())
-		return false;
-
-	if (rayHits.size() == 1)
-		return true;
 
+		if (visibleCorners > 0 && visibleCorners < patches.cornerCount[i])
+			return true;
+	}
 	return false;
 }
 
-bool Radiosity::isVisibleFrom(glm::vec3 point_j, glm::vec3 point_i)
+int Radiosity::markFacesForRefinement(Mesh* mesh, vector<vector<bool>>& marks)
 {
-	vector<RayHit> rayHits;
+	int patchCount = sceneFaces.size();
 
-	//now make a ray
-	Ray ray(point_i, point_j - point_i);
+	vector<int> emitters;
+	for (int i = 0; i < patchCount; i++)
+	{
+		glm::dvec3 emission = sceneFaces[i].emission;
+		if (emission.x > 0.0 || emission.y > 0.0 || emission.z > 0.0)
+			emitters.push_back(i);
+	}
 
-	for (int k = 0; k<sceneFaces.size(); k++)
+	// scene faces were loaded object by object, so the first patch of every object is a running sum
+	vector<int> firstPatch(mesh->sceneModel.size() + 1, 0);
+	for (int o = 0; o < mesh->sceneModel.size(); o++)
+		firstPatch[o + 1] = firstPatch[o] + mesh->sceneModel[o].obj_model.faces.size();
+	if (firstPatch.back() != patchCount)
 	{
-		int v0_k_index = sceneFaces[k].model->faces[sceneFaces[k].faceIndex].vertexIndexes[0];
-		int v1_k_index = sceneFaces[k].model->faces[sceneFaces[k].faceIndex].vertexIndexes[1];
-		int v2_k_index = sceneFaces[k].model->faces[sceneFaces[k].faceIndex].vertexIndexes[2];
+		printf("Scene faces are out of date, reload them before refining\n");
+		return 0;
+	}
 
-		glm::vec3 A = sceneFaces[k].model->vertices[v0_k_index];
-		glm::vec3 B = sceneFaces[k].model->vertices[v1_k_index];
-		glm::vec3 C = sceneFaces[k].model->vertices[v2_k_index];
+	vector<char> refine(patchCount, 0);
+	threadPool.parallelFor(mesh->sceneModel.size(), [&](int o, int) {
+		ObjectModel& model = mesh->sceneModel[o].obj_model;
 
-		glm::vec3 hitPoint;
-		if (glm::intersectRayTriangle(point_i, point_j - point_i, A, B, C, hitPoint))
+		for (int j = 0; j < model.faces.size(); j++)
 		{
-			RayHit currentHit;
-			currentHit.distance = glm::distance(ray.getStart(), hitPoint);
-			currentHit.hitSceneFaceIndex = k;
-			rayHits.push_back(currentHit);
-		}
-
-	}
+			int i = firstPatch[o] + j;
+			if (sceneFaces[i].emission != glm::dvec3(0.0))
+				continue;
 
-	// return's the values if it hits
-	return (rayHits.size() == 1);
+			// what the viewer shows, so bright emitters do not mark every neighbour
+			glm::dvec3 radiosity = glm::clamp(sceneFaces[i].totalRadiosity, 0.0, 1.0);
+			ModelFace& face = model.faces[j];
 
-}
+			for (int v = 0; v < face.vertexIndexes.size() && !refine[i]; v++)
+			{
+				int vertex = face.vertexIndexes[v];
+				for (int k = model.vertexFaceOffsets[vertex]; k < model.vertexFaceOffsets[vertex + 1]; k++)
+				{
+					glm::dvec3 neighbour = glm::clamp(sceneFaces[firstPatch[o] + model.vertexFaces[k]].totalRadiosity, 0.0, 1.0);
+					glm::dvec3 step = glm::abs(neighbour - radiosity);
+					if (glm::max(step.x, glm::max(step.y, step.z)) > ADAPTIVE_GRADIENT_THRESHOLD)
+					{
+						refine[i] = 1;
+						break;
+					}
+				}
+			}
+		}
+	});
 
-bool Radiosity::isVisibleFrom(Ray input, int & global_k, float & global_distance, glm::vec3  & r_ij)
-{
-	vector<RayHit> rayHits;
-	Ray ray = input;
+	threadPool.parallelFor(patchCount, [&](int i, int) {
+		if (!refine[i] && sceneFaces[i].emission == glm::dvec3(0.0) && isOnShadowBoundary(i, emitters))
+			refine[i] = 2;
+	});
 
-	for (int k = 0; k<sceneFaces.size(); k++)
+	int gradientCount = 0;
+	int shadowCount = 0;
+	marks.resize(mesh->sceneModel.size());
+	for (int o = 0; o < mesh->sceneModel.size(); o++)
 	{
-		int v0_k_index = sceneFaces[k].model->faces[sceneFaces[k].faceIndex].vertexIndexes[0];
-		int v1_k_index = sceneFaces[k].model->faces[sceneFaces[k].faceIndex].vertexIndexes[1];
-		int v2_k_index = sceneFaces[k].model->faces[sceneFaces[k].faceIndex].vertexIndexes[2];
-
-		glm::vec3 A = sceneFaces[k].model->vertices[v0_k_index];
-		glm::vec3 B = sceneFaces[k].model->vertices[v1_k_index];
-		glm::vec3 C = sceneFaces[k].model->vertices[v2_k_index];
-
-		glm::vec3 hitPoint;
-		RayHit currentHit;
-		if (sceneFaces[k].model->faces[sceneFaces[k].faceIndex].vertexIndexes.size() > 3) {
-			int v3_k_index = sceneFaces[k].model->faces[sceneFaces[k].faceIndex].vertexIndexes[3];
-			glm::vec3 D = sceneFaces[k].model->vertices[v3_k_index];
-
-			if (glm::intersectRayTriangle(input.getStart(), input.getDirection(), A, B, D, hitPoint)) {
-				currentHit.distance = glm::distance(ray.getStart(), hitPoint);
-				currentHit.hitpoint = hitPoint;
-				currentHit.hitSceneFaceIndex = k;
-				hitPoint = glm::vec3(0.0f);
-			}
-			else if (glm::intersectRayTriangle(input.getStart(), input.getDirection(), C, B, D, hitPoint)) {
-				currentHit.distance = glm::distance(ray.getStart(), hitPoint);
-				currentHit.hitpoint = hitPoint;
-				currentHit.hitSceneFaceIndex = k;
-				rayHits.push_back(currentHit);
-				hitPoint = glm::vec3(0.0f);
-			}
-			else if (glm::intersectRayTriangle(input.getStart(), input.getDirection(), A, C, D, hitPoint)) {
-				currentHit.distance = glm::distance(ray.getStart(), hitPoint);
-				currentHit.hitpoint = hitPoint;
-				currentHit.hitSceneFaceIndex = k;
-				rayHits.push_back(currentHit);
-				hitPoint = glm::vec3(0.0f);
-			}
-			else if (glm::intersectRayTriangle(input.getStart(), input.getDirection(), A, B, C, hitPoint)) {
-				currentHit.distance = glm::distance(ray.getStart(), hitPoint);
-				currentHit.hitpoint = hitPoint;
-				currentHit.hitSceneFaceIndex = k;
-				rayHits.push_back(currentHit);
-				hitPoint = glm::vec3(0.0f);
-			}
-
-			hitPoint = glm::vec3(0.0f);
-		}
-		else if (glm::intersectRayTriangle(input.getStart(), input.getDirection(), A, B, C, hitPoint)) {
-			currentHit.distance = glm::distance(ray.getStart(), hitPoint);
-			currentHit.hitpoint = hitPoint;
-			currentHit.hitSceneFaceIndex = k;
-			rayHits.push_back(currentHit);
+		marks[o].assign(mesh->sceneModel[o].obj_model.faces.size(), false);
+		for (int j = 0; j < marks[o].size(); j++)
+		{
+			char reason = refine[firstPatch[o] + j];
+			marks[o][j] = reason != 0;
+			gradientCount += reason == 1;
+			shadowCount += reason == 2;
 		}
+	}
 
+	printf("Refining %d of %d patches (%d on gradients, %d on shadow boundaries)\n", gradientCount + shadowCount, patchCount, gradientCount, shadowCount);
+	return gradientCount + shadowCount;
+}
 
+bool Radiosity::writePatchResults(string fileName)
+{
+	ofstream file(fileName);
+	if (!file.is_open())
+	{
+		printf("Could not write patch results %s\n", fileName.c_str());
+		return false;
 	}
 
-	if (rayHits.size() >= 1) {
-		global_k = rayHits[0].hitSceneFaceIndex;
-		float distance = rayHits[0].distance;
-		global_distance = distance;
-		r_ij = rayHits[0].hitpoint;
-
-		for (int j = 1; j < rayHits.size(); j++) {
+	file << "patch,face,area,centroid_x,centroid_y,centroid_z,radiosity_r,radiosity_g,radiosity_b\n";
+	for (int i = 0; i < sceneFaces.size(); i++)
+	{
+		glm::vec3 centroid = patches.centroid[i];
+		glm::dvec3 radiosity = sceneFaces[i].totalRadiosity;
 
-			if (rayHits[j].distance < distance) {
-				global_k = rayHits[j].hitSceneFaceIndex;
-				distance = rayHits[j].distance;
-				global_distance = distance;
-				r_ij = rayHits[j].hitpoint;
+		file << i << ',' << sceneFaces[i].faceIndex << ',' << patches.area[i] << ','
+			<< centroid.x << ',' << centroid.y << ',' << centroid.z << ','
+			<< radiosity.x << ',' << radiosity.y << ',' << radiosity.z << '\n';
+	}
+	return file.good();
+}
 
-			}
-		}
+bool Radiosity::isParallelToFace(Ray* r, int i)
+{
+	glm::vec3 n = patches.normal[i];
+	float dotProduct = abs(glm::dot(n, r->getDirection()));
+	if (dotProduct <= 0.001f)
+		return true;
+	return false;
+}
 
-	}
+bool Radiosity::isVisibleFrom(int i, int j)
+{
+	return !grid.isOccluded(patches.centroid[i], patches.centroid[j], i, j);
+}
 
-	// return's the values if it hits
-	return (rayHits.size() == 1);
+bool Radiosity::isVisibleFrom(glm::vec3 point_j, glm::vec3 point_i)
+{
+	return !grid.isOccluded(point_i, point_j);
+}
 
+bool Radiosity::isVisibleFrom(Ray input, int & global_k, float & global_distance, glm::vec3  & r_ij)
+{
+	// closest hit through the BVH built in loadSceneFacesFromMesh
+	return bvh.intersect(input, global_k, global_distance, r_ij);
 }
 
 
@@ -591,19 +985,15 @@ bool Radiosity::isVisibleFrom(Ray input, int & global_k, float & global_distance
 bool Radiosity::doesRayHit(Ray* ray, int k, glm::vec3& hitPoint)
 {
 	//check if ray is parallel to face
-	glm::vec3 n_k = sceneFaces[k].model->getFaceNormal(sceneFaces[k].faceIndex);
+	glm::vec3 n_k = patches.normal[k];
 
 	//if(isParallelToFace(ray, k))
 	//	return false;
 
 	//get all vertices of k
-	int v0_k_index = sceneFaces[k].model->faces[sceneFaces[k].faceIndex].vertexIndexes[0];
-	int v1_k_index = sceneFaces[k].model->faces[sceneFaces[k].faceIndex].vertexIndexes[1];
-	int v2_k_index = sceneFaces[k].model->faces[sceneFaces[k].faceIndex].vertexIndexes[2];
-
-	glm::vec3 A = sceneFaces[k].model->vertices[v0_k_index];
-	glm::vec3 B = sceneFaces[k].model->vertices[v1_k_index];
-	glm::vec3 C = sceneFaces[k].model->vertices[v2_k_index];
+	glm::vec3 A = patches.a[k];
+	glm::vec3 B = patches.b[k];
+	glm::vec3 C = patches.c[k];
 
 	//first we handle the case where patch k has only 3 vertices
 
@@ -629,7 +1019,7 @@ bool Radiosity::doesRayHit(Ray* ray, int k, glm::vec3& hitPoint)
 	glm::vec3 Q = ray->getStart() + (t * ray->getDirection());
 
 	//now we determine if Q is inside or outside of k
-	if (sceneFaces[k].model->faces[sceneFaces[k].faceIndex].vertexIndexes.size() == 3)
+	if (patches.cornerCount[k] == 3)
 	{
 		float AB_EDGE = glm::dot(glm::cross((B - A), (Q - A)), n_k);
 		float BC_EDGE = glm::dot(glm::cross((C - B), (Q - B)), n_k);
@@ -651,8 +1041,7 @@ bool Radiosity::doesRayHit(Ray* ray, int k, glm::vec3& hitPoint)
 	}
 	else
 	{
-		int v3_k_index = sceneFaces[k].model->faces[sceneFaces[k].faceIndex].vertexIndexes[3];
-		glm::vec3 D = sceneFaces[k].model->vertices[v3_k_index];
+		glm::vec3 D = patches.d[k];
 
 		float AB_EDGE = glm::dot(glm::cross((B - A), (Q - A)), n_k);
 		float BD_EDGE = glm::dot(glm::cross((D - B), (Q - B)), n_k);
@@ -3,10 +3,21 @@
 
 #include "Mesh.h"
 #include "RadiosityFace.h"
+#include "RadiosityOptions.h"
 #include "Ray.h"
+#include "BVH.h"
+#include "UniformGrid.h"
+#include "PatchTable.h"
+#include "ThreadPool.h"
+#include "FormFactorMatrix.h"
+#include "HierarchicalRadiosity.h"
 #include <vector>
 #include <iostream>
 #include <chrono>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <atomic>
 
 #include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
@@ -35,17 +46,22 @@ using namespace std;
 class Radiosity
 {
 public:
+	Radiosity();
+	~Radiosity();
+
 	void loadSceneFacesFromMesh(Mesh* mesh);
 	void initEmittedEnergies();
 	void initRadiosityValues();
-	void calculateFormFactorsForFace(int i, int samplePoints);
+	// returns the rays traced. parallel splits the row's rays over the thread pool, callers that
+	// already run inside parallelFor must leave it false
+	int calculateFormFactorsForFace(int i, int samplePoints, mt19937& generator, FormFactorRow& formFactorRow, bool parallel = false);
 	void PrepareUnshotRadiosityValues();
 	void calculateRadiosityValues();
 	glm::vec2 Radiosity::getTotalCounts(Mesh *mesh);
 	bool doesRayHit(Ray* ray, int j, glm::vec3& hitPoint);
-	bool isVisibleFrom(int i, int j);
+	bool isVisibleFrom(int i, int j); // centroid to centroid, only patches other than i and j can block
 
-	bool isVisibleFrom(glm::vec3 point_j, glm::vec3 point_i);
+	bool isVisibleFrom(glm::vec3 point_j, glm::vec3 point_i); // nothing blocks the segment between the points
 
 	bool isVisibleFrom(Ray input, int & global_k, float & global_distance, glm::vec3  & r_ij);
 
@@ -54,14 +70,66 @@ public:
 
 	void setMeshFaceColors();
 
+	// Adaptive subdivision: marks[object][face] is set for the patches of the last solution whose
+	// radiosity differs from a neighbour by more than ADAPTIVE_GRADIENT_THRESHOLD or whose corners
+	// disagree on the visibility of an emitter. Returns the number of marked patches.
+	int markFacesForRefinement(Mesh* mesh, vector<vector<bool>>& marks);
+	bool writePatchResults(string fileName);
+
 	int getMaxUnshotRadiosityFaceIndex();
 
+	void setOptions(RadiosityOptions newOptions) { options = newOptions; }
+
+	// Background solving for the viewer. startAsyncSolve runs calculateRadiosityValues on its own
+	// thread and returns false if one is already running. The mesh and the scene faces must not be
+	// changed until isSolving() is false. applySnapshotToMesh is called by the render thread every frame
+	// and copies the newest published radiosity into the face colors, it returns false if there is nothing new.
+	bool startAsyncSolve();
+	bool isSolving() { return solving; }
+	void stopAsyncSolve(); // progressive and iterative solvers stop at their next step
+	bool applySnapshotToMesh();
+
 
 private:
+	void calculateFormFactorsOnCPU(int samplePoints, vector<int>& rays); // rays receives the count traced per row
+	void traceSampleRays(int i, glm::vec4* samples, int count, int* hits);
+	void sampleRays(int i, int first, int count, glm::vec4 rotation, mt19937& generator, bool parallel, glm::vec4* samples, int* hits);
+	int calculateFormFactorsAdaptive(int i, mt19937& generator, FormFactorRow& formFactorRow, bool parallel);
+	void prepareSampleWeights();
+	double getSampleWeight(int i);
+	void prepareThreadGenerators();
+	unsigned long long getGeometryHash(int samplePoints);
+	void solveProgressive();
+	void solveIterative(vector<glm::dvec3>& reflectance, bool gaussSeidel);
+	void solveHierarchical();
+	void publishSnapshot(bool force);
+	bool isOnShadowBoundary(int i, vector<int>& emitters);
+
+	RadiosityOptions options;
 
 	vector<RadiosityFace> sceneFaces;
-	vector<vector<double>> formFactors;
+	PatchTable patches; // flat geometry and reflectance of sceneFaces, same indexing
+	FormFactorMatrix formFactors;
+	HierarchicalRadiosity hierarchy; // used instead of formFactors by SOLVER_HIERARCHICAL
+	PatchTable inputFaces; // the unsubdivided faces the hierarchy starts from, empty for the other solvers
+	BVH bvh;
+	UniformGrid grid; // point to point visibility, the BVH serves the closest hit queries
+
+	ThreadPool threadPool;
+	vector<mt19937> threadGenerators; // one per pool worker, rand() is not thread safe
+	double meanSampleWeight; // average getSampleWeight over the patches, for adaptive sampling
+
+	thread solverThread;
+	atomic<bool> solving;
+	atomic<bool> cancelRequested;
 
+	// double buffered snapshots: the solver thread fills the back one from sceneFaces and swaps
+	// it with the front one under the mutex, the render thread reads the front one under the mutex
+	mutex snapshotMutex;
+	vector<glm::dvec3> frontSnapshot;
+	vector<glm::dvec3> backSnapshot;
+	bool snapshotReady;
+	Timer snapshotTimer;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,71 @@
+#ifndef RADIOSITY_OPTIONS_H
+#define RADIOSITY_OPTIONS_H
+
+#include <string>
+
+enum RadiositySolver
+{
+	SOLVER_MATRIX_INVERSE,		//0 inverts I - RF for every color channel
+	SOLVER_PROGRESSIVE,			//1 shoots the largest unshot radiosity, one form factor row at a time
+	SOLVER_LU,					//2 LU factorization of I - RF, solved directly for the emission vector
+	SOLVER_JACOBI,				//3 iterative gathering, every patch gathers from the previous iterate
+	SOLVER_GAUSS_SEIDEL,		//4 iterative gathering, patches gather from values already updated this sweep
+	SOLVER_HIERARCHICAL			//5 HierarchicalRadiosity, links between subdivision levels of each patch instead of a form factor matrix
+};
+
+enum FormFactorBackend
+{
+	BACKEND_CPU_BVH,			//0 one ray at a time against the BVH, sampled with PatchTable::sampleDirection
+	BACKEND_GPU,				//1 RayShoot.cu, every ray tested against every patch on the GPU
+	BACKEND_CPU_SIMD			//2 RayShootCPU.cpp, the GPU algorithm with SSE/AVX triangle tests
+};
+
+enum SampleSequence
+{
+	SAMPLES_RANDOM,				//0 independent uniform numbers
+	SAMPLES_STRATIFIED,			//1 jittered grids over the patch and over the hemisphere
+	SAMPLES_HALTON,				//2 Halton points in bases 2, 3, 5, 7, randomly rotated per patch
+	SAMPLES_SOBOL				//3 Sobol points, randomly rotated per patch
+};
+
+enum ReciprocityMode
+{
+	RECIPROCITY_OFF,			//0 every row is used as it was sampled
+	RECIPROCITY_COMBINE,		//1 A_i F_ij and A_j F_ji are averaged by inverse variance, same rays, less noise
+	RECIPROCITY_HALF			//2 as COMBINE but with half the rays per row, about the noise of OFF
+};
+
+enum FormFactorExportFormat
+{
+	EXPORT_NONE,
+	EXPORT_DENSE,				// rowCount * columnCount float32 values, row major
+	EXPORT_SPARSE				// same CSR sections as the form factor cache
+};
+
+struct RadiosityOptions
+{
+	RadiositySolver solver;
+	FormFactorBackend backend; // where form factors are computed when they are not cached
+	SampleSequence sampleSequence; // sample points and directions of the CPU BVH backend and the progressive solver
+	bool adaptiveSampling; // CPU BVH rows get rays by patch energy until their entries settle, instead of a fixed count
+	ReciprocityMode reciprocity; // applies to the form factor matrix, the progressive solver samples single rows and ignores it
+	int maxIterations; // upper bound on shots or sweeps for the non direct solvers, 0 means the solver default
+	double toleranceScale; // iterative solvers stop once the residual is below RADIOSITY_SOLUTION_THRESHOLD * toleranceScale, progressive once no patch holds more than this fraction of the emitted energy unshot
+	std::string formFactorCacheDir; // where form factors are cached by geometry hash, empty disables the cache
+	std::string formFactorExportFile; // binary dump of the form factor matrix, read back with FormFactorTool
+	FormFactorExportFormat formFactorExportFormat;
+
+	RadiosityOptions()
+	{
+		solver = SOLVER_MATRIX_INVERSE;
+		backend = BACKEND_GPU;
+		sampleSequence = SAMPLES_RANDOM;
+		adaptiveSampling = false;
+		reciprocity = RECIPROCITY_OFF;
+		maxIterations = 0;
+		toleranceScale = 0.01;
+		formFactorExportFormat = EXPORT_NONE;
+	}
+};
+
+#endif
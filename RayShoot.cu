@@ -10,6 +10,7 @@
 #include <curand_kernel.h>
 #include <cuda.h>
 #include "errorchecking.cu"
+#include "HemisphereSampling.h"
 //
 //#define PATCH_NUM 512
 //#define SAMPLES 512
@@ -19,6 +20,8 @@ struct PatchData {
 	optix::float3 b;
 	optix::float3 c;
 	optix::float3 norm;
+	optix::float3 tangent; // orthonormal frame for the ray directions, from PatchTable
+	optix::float3 bitangent;
 	int id;
 
 };
@@ -118,24 +121,15 @@ __global__ void generate_ray_dir(curandState*globalState, PatchData *faces, int
 		int idx = (threadIdx.x * 4 + blockIdx.x * 512 + h)%32;//threadIdx.x*32 + blockDim.x*blockIdx.x + h;
 		int i = blockIdx.x;
 
-		float sin_theta = sqrt(generate(globalState, idx));
-		float cos_theta = sqrt(1 - sin_theta * sin_theta);
-		float psi = 2 * 3.14159265359 * generate(globalState, idx);
-		optix::float3 a1 = optix::make_float3(sin_theta) * cos(psi);
-		optix::float3 b1 = optix::make_float3(sin_theta) * sin(psi);
-		optix::float3 c1 = optix::make_float3(cos_theta);
-
-
-		optix::float3 v1 = a1 * (faces[i].b - faces[i].a);
-		optix::float3 v2 = b1 * (faces[i].c - faces[i].a);
-		optix::float3 v3 = c1 * faces[i].norm;
+		float u = generate(globalState, idx);
+		float v = generate(globalState, idx);
+		optix::float3 direction = cosineWeightedDirection(u, v, faces[i].tangent, faces[i].bitangent, faces[i].norm);
 
 		float r2 = generate(globalState,idx);
 		float r1 = generate(globalState, idx);
 		optix::float3 pt =(float)((1.0 - sqrt(r1)))*faces[i].a +
 			(float)((sqrt(r1)) * (1.0 - r2))*faces[i].b + 
 			(float)(r2 * sqrt(r1))*faces[i].c;
-		optix::float3 direction = optix::normalize(v1 + v2 + v3);
 		Ray ray = Ray(pt, direction);
 
 		int face = 12;
@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+#include <float.h>
+#include <time.h>
+#include <random>
+#include <vector>
+#include <optixu/optixu_math_namespace.h>
+#include "ThreadPool.h"
+#include "HemisphereSampling.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define RAY_SHOOT_SIMD_WIDTH	8
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RAY_SHOOT_SIMD_WIDTH	4
+#else
+#define RAY_SHOOT_SIMD_WIDTH	1
+#endif
+
+#define RAY_SHOOT_EPSILON		0.001f // same self intersection cutoff as the GPU kernel
+#define RAY_SHOOT_MAX_RETRIES	64 // the GPU kernel retries forever, here a sample gives up and records -1
+
+// CPU port of RayShoot.cu. It takes the same patch list and returns the same
+// PATCH_NUM x SAMPLES hit buffer, so the two can be swapped without touching the
+// code that decodes the hits into form factors.
+
+struct PatchData {
+	optix::float3 a;
+	optix::float3 b;
+	optix::float3 c;
+	optix::float3 norm;
+	optix::float3 tangent; // orthonormal frame for the ray directions, from PatchTable
+	optix::float3 bitangent;
+	int id;
+};
+
+// Structure of arrays copy of the patches so a single load fetches the same
+// component of RAY_SHOOT_SIMD_WIDTH consecutive triangles. The tail is padded
+// with degenerate triangles which the determinant test always rejects.
+struct PatchDataSoA
+{
+	vector<float> v0x, v0y, v0z;
+	vector<float> e1x, e1y, e1z;
+	vector<float> e2x, e2y, e2z;
+	int count;
+	int paddedCount;
+
+	void build(PatchData* patches, int patchCount)
+	{
+		count = patchCount;
+		paddedCount = (patchCount + RAY_SHOOT_SIMD_WIDTH - 1) / RAY_SHOOT_SIMD_WIDTH * RAY_SHOOT_SIMD_WIDTH;
+
+		vector<float>* arrays[9] = { &v0x, &v0y, &v0z, &e1x, &e1y, &e1z, &e2x, &e2y, &e2z };
+		for (int k = 0; k < 9; k++)
+			arrays[k]->assign(paddedCount, 0.0f);
+
+		for (int i = 0; i < patchCount; i++)
+		{
+			optix::float3 edge1 = patches[i].b - patches[i].a;
+			optix::float3 edge2 = patches[i].c - patches[i].a;
+
+			v0x[i] = patches[i].a.x; v0y[i] = patches[i].a.y; v0z[i] = patches[i].a.z;
+			e1x[i] = edge1.x; e1y[i] = edge1.y; e1z[i] = edge1.z;
+			e2x[i] = edge2.x; e2y[i] = edge2.y; e2z[i] = edge2.z;
+		}
+	}
+};
+
+// one triangle at a time, used for the scalar build and as the reference for the vector paths
+static float rayTriangleIntersection(optix::float3& orig, optix::float3& dir, PatchDataSoA& soa, int i)
+{
+	optix::float3 v0 = optix::make_float3(soa.v0x[i], soa.v0y[i], soa.v0z[i]);
+	optix::float3 edge1 = optix::make_float3(soa.e1x[i], soa.e1y[i], soa.e1z[i]);
+	optix::float3 edge2 = optix::make_float3(soa.e2x[i], soa.e2y[i], soa.e2z[i]);
+
+	optix::float3 pvec = optix::cross(dir, edge2);
+	float det = optix::dot(edge1, pvec);
+	if (fabs(det) < 1e-8f)
+		return -1.0f;
+	float invDet = 1.0f / det;
+
+	optix::float3 tvec = orig - v0;
+	float u = optix::dot(tvec, pvec) * invDet;
+	if (u < 0.0f || u > 1.0f)
+		return -1.0f;
+
+	optix::float3 qvec = optix::cross(tvec, edge1);
+	float v = optix::dot(dir, qvec) * invDet;
+	if (v < 0.0f || (u + v) > 1.0f)
+		return -1.0f;
+
+	return optix::dot(edge2, qvec) * invDet;
+}
+
+#if RAY_SHOOT_SIMD_WIDTH == 8
+
+#define SIMD_FLOAT				__m256
+#define SIMD_SET1(x)			_mm256_set1_ps(x)
+#define SIMD_LOAD(p)			_mm256_loadu_ps(p)
+#define SIMD_STORE(p, x)		_mm256_storeu_ps(p, x)
+#define SIMD_ADD(a, b)			_mm256_add_ps(a, b)
+#define SIMD_SUB(a, b)			_mm256_sub_ps(a, b)
+#define SIMD_MUL(a, b)			_mm256_mul_ps(a, b)
+#define SIMD_DIV(a, b)			_mm256_div_ps(a, b)
+#define SIMD_AND(a, b)			_mm256_and_ps(a, b)
+#define SIMD_ANDNOT(a, b)		_mm256_andnot_ps(a, b)
+#define SIMD_BLEND(a, b, mask)	_mm256_blendv_ps(a, b, mask)
+#define SIMD_GE(a, b)			_mm256_cmp_ps(a, b, _CMP_GE_OQ)
+#define SIMD_LE(a, b)			_mm256_cmp_ps(a, b, _CMP_LE_OQ)
+#define SIMD_GT(a, b)			_mm256_cmp_ps(a, b, _CMP_GT_OQ)
+#define SIMD_LT(a, b)			_mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define SIMD_MOVEMASK(a)		_mm256_movemask_ps(a)
+
+#elif RAY_SHOOT_SIMD_WIDTH == 4
+
+#define SIMD_FLOAT				__m128
+#define SIMD_SET1(x)			_mm_set1_ps(x)
+#define SIMD_LOAD(p)			_mm_loadu_ps(p)
+#define SIMD_STORE(p, x)		_mm_storeu_ps(p, x)
+#define SIMD_ADD(a, b)			_mm_add_ps(a, b)
+#define SIMD_SUB(a, b)			_mm_sub_ps(a, b)
+#define SIMD_MUL(a, b)			_mm_mul_ps(a, b)
+#define SIMD_DIV(a, b)			_mm_div_ps(a, b)
+#define SIMD_AND(a, b)			_mm_and_ps(a, b)
+#define SIMD_ANDNOT(a, b)		_mm_andnot_ps(a, b)
+#define SIMD_BLEND(a, b, mask)	_mm_or_ps(_mm_andnot_ps(mask, a), _mm_and_ps(mask, b)) // SSE2 has no blendv
+#define SIMD_GE(a, b)			_mm_cmpge_ps(a, b)
+#define SIMD_LE(a, b)			_mm_cmple_ps(a, b)
+#define SIMD_GT(a, b)			_mm_cmpgt_ps(a, b)
+#define SIMD_LT(a, b)			_mm_cmplt_ps(a, b)
+#define SIMD_MOVEMASK(a)		_mm_movemask_ps(a)
+
+#endif
+
+// Closest hit over every patch, same result as intersectAllTriangles in RayShoot.cu
+static int intersectAllTriangles(optix::float3& orig, optix::float3& dir, PatchDataSoA& soa)
+{
+	float minDist = FLT_MAX;
+	int minFace = -1;
+
+#if RAY_SHOOT_SIMD_WIDTH > 1
+	SIMD_FLOAT ox = SIMD_SET1(orig.x), oy = SIMD_SET1(orig.y), oz = SIMD_SET1(orig.z);
+	SIMD_FLOAT dx = SIMD_SET1(dir.x), dy = SIMD_SET1(dir.y), dz = SIMD_SET1(dir.z);
+	SIMD_FLOAT zero = SIMD_SET1(0.0f);
+	SIMD_FLOAT one = SIMD_SET1(1.0f);
+	SIMD_FLOAT detEpsilon = SIMD_SET1(1e-8f);
+	SIMD_FLOAT rayEpsilon = SIMD_SET1(RAY_SHOOT_EPSILON);
+	SIMD_FLOAT signMask = SIMD_SET1(-0.0f);
+
+	// every lane tracks its own closest hit, the lanes are reduced once at the end
+	SIMD_FLOAT laneDist = SIMD_SET1(FLT_MAX);
+	SIMD_FLOAT laneFace = SIMD_SET1(-1.0f);
+	SIMD_FLOAT laneStep = SIMD_SET1((float)RAY_SHOOT_SIMD_WIDTH);
+	float firstIndexes[RAY_SHOOT_SIMD_WIDTH];
+	for (int k = 0; k < RAY_SHOOT_SIMD_WIDTH; k++)
+		firstIndexes[k] = (float)k;
+	SIMD_FLOAT faceIndex = SIMD_LOAD(firstIndexes);
+
+	for (int i = 0; i < soa.paddedCount; i += RAY_SHOOT_SIMD_WIDTH)
+	{
+		SIMD_FLOAT e1x = SIMD_LOAD(&soa.e1x[i]), e1y = SIMD_LOAD(&soa.e1y[i]), e1z = SIMD_LOAD(&soa.e1z[i]);
+		SIMD_FLOAT e2x = SIMD_LOAD(&soa.e2x[i]), e2y = SIMD_LOAD(&soa.e2y[i]), e2z = SIMD_LOAD(&soa.e2z[i]);
+
+		// pvec = dir x edge2
+		SIMD_FLOAT px = SIMD_SUB(SIMD_MUL(dy, e2z), SIMD_MUL(dz, e2y));
+		SIMD_FLOAT py = SIMD_SUB(SIMD_MUL(dz, e2x), SIMD_MUL(dx, e2z));
+		SIMD_FLOAT pz = SIMD_SUB(SIMD_MUL(dx, e2y), SIMD_MUL(dy, e2x));
+
+		SIMD_FLOAT det = SIMD_ADD(SIMD_ADD(SIMD_MUL(e1x, px), SIMD_MUL(e1y, py)), SIMD_MUL(e1z, pz));
+		SIMD_FLOAT mask = SIMD_GT(SIMD_ANDNOT(signMask, det), detEpsilon);
+		SIMD_FLOAT invDet = SIMD_DIV(one, det);
+
+		// tvec = orig - v0
+		SIMD_FLOAT tx = SIMD_SUB(ox, SIMD_LOAD(&soa.v0x[i]));
+		SIMD_FLOAT ty = SIMD_SUB(oy, SIMD_LOAD(&soa.v0y[i]));
+		SIMD_FLOAT tz = SIMD_SUB(oz, SIMD_LOAD(&soa.v0z[i]));
+
+		SIMD_FLOAT u = SIMD_MUL(SIMD_ADD(SIMD_ADD(SIMD_MUL(tx, px), SIMD_MUL(ty, py)), SIMD_MUL(tz, pz)), invDet);
+		mask = SIMD_AND(mask, SIMD_AND(SIMD_GE(u, zero), SIMD_LE(u, one)));
+
+		// qvec = tvec x edge1
+		SIMD_FLOAT qx = SIMD_SUB(SIMD_MUL(ty, e1z), SIMD_MUL(tz, e1y));
+		SIMD_FLOAT qy = SIMD_SUB(SIMD_MUL(tz, e1x), SIMD_MUL(tx, e1z));
+		SIMD_FLOAT qz = SIMD_SUB(SIMD_MUL(tx, e1y), SIMD_MUL(ty, e1x));
+
+		SIMD_FLOAT v = SIMD_MUL(SIMD_ADD(SIMD_ADD(SIMD_MUL(dx, qx), SIMD_MUL(dy, qy)), SIMD_MUL(dz, qz)), invDet);
+		mask = SIMD_AND(mask, SIMD_AND(SIMD_GE(v, zero), SIMD_LE(SIMD_ADD(u, v), one)));
+
+		SIMD_FLOAT t = SIMD_MUL(SIMD_ADD(SIMD_ADD(SIMD_MUL(e2x, qx), SIMD_MUL(e2y, qy)), SIMD_MUL(e2z, qz)), invDet);
+		mask = SIMD_AND(mask, SIMD_AND(SIMD_GT(t, rayEpsilon), SIMD_LT(t, laneDist)));
+
+		if (SIMD_MOVEMASK(mask))
+		{
+			laneDist = SIMD_BLEND(laneDist, t, mask);
+			laneFace = SIMD_BLEND(laneFace, faceIndex, mask);
+		}
+		faceIndex = SIMD_ADD(faceIndex, laneStep);
+	}
+
+	float dists[RAY_SHOOT_SIMD_WIDTH], faces[RAY_SHOOT_SIMD_WIDTH];
+	SIMD_STORE(dists, laneDist);
+	SIMD_STORE(faces, laneFace);
+	for (int k = 0; k < RAY_SHOOT_SIMD_WIDTH; k++)
+	{
+		int face = (int)faces[k];
+		// ties go to the lower index, like the sequential loop on the GPU
+		if (face >= 0 && (dists[k] < minDist || (dists[k] == minDist && face < minFace)))
+		{
+			minDist = dists[k];
+			minFace = face;
+		}
+	}
+#else
+	for (int i = 0; i < soa.count; i++)
+	{
+		float dist = rayTriangleIntersection(orig, dir, soa, i);
+		if (dist < minDist && dist > RAY_SHOOT_EPSILON)
+		{
+			minDist = dist;
+			minFace = i;
+		}
+	}
+#endif
+
+	return minFace;
+}
+
+// Same sampling as generate_ray_dir: a random point on the triangle and a cosine
+// weighted direction around the normal, retried until something is hit
+static void shootPatch(PatchData* patches, PatchDataSoA& soa, int i, int samples, mt19937& generator, int* hit)
+{
+	uniform_real_distribution<float> distribution(0.0f, 1.0f);
+	PatchData& patch = patches[i];
+
+	for (int h = 0; h < samples; h++)
+	{
+		int face = -1;
+		for (int retry = 0; retry < RAY_SHOOT_MAX_RETRIES && face == -1; retry++)
+		{
+			float u = distribution(generator);
+			float v = distribution(generator);
+			optix::float3 direction = cosineWeightedDirection(u, v, patch.tangent, patch.bitangent, patch.norm);
+
+			float r2 = distribution(generator);
+			float r1 = distribution(generator);
+			optix::float3 pt = (1.0f - sqrt(r1)) * patch.a +
+				(sqrt(r1) * (1.0f - r2)) * patch.b +
+				(r2 * sqrt(r1)) * patch.c;
+
+			face = intersectAllTriangles(pt, direction, soa);
+		}
+		hit[i * samples + h] = face;
+	}
+}
+
+int* main_test_cpu(PatchData *patches, int PATCH_NUM, int SAMPLES) {
+	int* c_hit = (int*)malloc(SAMPLES*PATCH_NUM * sizeof(int));
+
+	PatchDataSoA soa;
+	soa.build(patches, PATCH_NUM);
+
+	ThreadPool pool;
+	printf("%d patches, %d wide SIMD, %d threads\n", PATCH_NUM, RAY_SHOOT_SIMD_WIDTH, pool.getThreadCount());
+
+	// one generator per patch keeps the result independent of how patches land on threads
+	unsigned seed = unsigned(time(NULL));
+	pool.parallelFor(PATCH_NUM, [&](int i, int) {
+		mt19937 generator(seed + i);
+		shootPatch(patches, soa, i, SAMPLES, generator, c_hit);
+	});
+
+	return c_hit;
+}
@@ -0,0 +1,159 @@
+#include "Sampler.h"
+
+#include <vector>
+#include <algorithm>
+
+// largest float below 1, keeps rotated and jittered values inside [0,1)
+#define ONE_MINUS_EPSILON	0.99999994f
+
+float radicalInverse(int base, unsigned int index)
+{
+	double inverseBase = 1.0 / base;
+	double factor = inverseBase;
+	double result = 0.0;
+	while (index > 0)
+	{
+		result += (index % base) * factor;
+		index /= base;
+		factor *= inverseBase;
+	}
+	return (float)min(result, (double)ONE_MINUS_EPSILON);
+}
+
+// Direction numbers for the first four dimensions from Joe and Kuo (new-joe-kuo-6.21201).
+// The first dimension is the van der Corput sequence, the others are given by the degree s,
+// the coefficients a of their primitive polynomial and the initial numbers m.
+struct SobolTable
+{
+	unsigned int directions[SOBOL_DIMENSIONS][SOBOL_BITS];
+
+	SobolTable()
+	{
+		const int degrees[SOBOL_DIMENSIONS] = { 0, 1, 2, 3 };
+		const unsigned int coefficients[SOBOL_DIMENSIONS] = { 0, 0, 1, 1 };
+		const unsigned int initial[SOBOL_DIMENSIONS][3] = { { 0, 0, 0 }, { 1, 0, 0 }, { 1, 3, 0 }, { 1, 3, 1 } };
+
+		for (int k = 0; k < SOBOL_BITS; k++)
+			directions[0][k] = 1u << (SOBOL_BITS - 1 - k);
+
+		for (int d = 1; d < SOBOL_DIMENSIONS; d++)
+		{
+			int s = degrees[d];
+			unsigned int* v = directions[d];
+			for (int k = 0; k < s; k++)
+				v[k] = initial[d][k] << (SOBOL_BITS - 1 - k);
+
+			for (int k = s; k < SOBOL_BITS; k++)
+			{
+				v[k] = v[k - s] ^ (v[k - s] >> s);
+				for (int j = 1; j < s; j++)
+					v[k] ^= ((coefficients[d] >> (s - 1 - j)) & 1) * v[k - j];
+			}
+		}
+	}
+};
+
+float sobolSample(int dimension, unsigned int index)
+{
+	static const SobolTable table;
+
+	unsigned int result = 0;
+	for (int k = 0; index != 0; k++, index >>= 1)
+	{
+		if (index & 1)
+			result ^= table.directions[dimension][k];
+	}
+	return min((float)(result * (1.0 / 4294967296.0)), ONE_MINUS_EPSILON);
+}
+
+glm::vec3 cosineWeightedDirection(float u, float v)
+{
+	return cosineWeightedDirection(u, v, glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+}
+
+static float rotate(float value, float offset)
+{
+	value += offset;
+	if (value >= 1.0f)
+		value -= 1.0f;
+	return min(value, ONE_MINUS_EPSILON);
+}
+
+// jittered points in a columns x rows grid, the last count - columns * rows points are uniform
+static void stratify2D(int count, mt19937& generator, vector<glm::vec2>& points)
+{
+	uniform_real_distribution<float> uniform(0.0f, 1.0f);
+	int columns = max(1, (int)glm::sqrt((float)count));
+	int rows = max(1, count / columns);
+
+	points.resize(count);
+	int k = 0;
+	for (int y = 0; y < rows && k < count; y++)
+	{
+		for (int x = 0; x < columns && k < count; x++, k++)
+		{
+			points[k].x = min((x + uniform(generator)) / columns, ONE_MINUS_EPSILON);
+			points[k].y = min((y + uniform(generator)) / rows, ONE_MINUS_EPSILON);
+		}
+	}
+	for (; k < count; k++)
+		points[k] = glm::vec2(uniform(generator), uniform(generator));
+}
+
+glm::vec4 randomRotation(mt19937& generator)
+{
+	uniform_real_distribution<float> uniform(0.0f, 1.0f);
+	return glm::vec4(uniform(generator), uniform(generator), uniform(generator), uniform(generator));
+}
+
+void generateSampleRange(SampleSequence sequence, int first, int count, glm::vec4 rotation, mt19937& generator, glm::vec4* samples)
+{
+	uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+	if (sequence == SAMPLES_STRATIFIED)
+	{
+		vector<glm::vec2> positions;
+		vector<glm::vec2> directions;
+		stratify2D(count, generator, positions);
+		stratify2D(count, generator, directions);
+		shuffle(directions.begin(), directions.end(), generator);
+
+		for (int k = 0; k < count; k++)
+			samples[k] = glm::vec4(positions[k].x, positions[k].y, directions[k].x, directions[k].y);
+		return;
+	}
+
+	if (sequence == SAMPLES_HALTON || sequence == SAMPLES_SOBOL)
+	{
+		const int bases[4] = { 2, 3, 5, 7 };
+
+		for (int k = 0; k < count; k++)
+		{
+			for (int d = 0; d < 4; d++)
+			{
+				float value = sequence == SAMPLES_HALTON ? radicalInverse(bases[d], first + k) : sobolSample(d, first + k);
+				samples[k][d] = rotate(value, rotation[d]);
+			}
+		}
+		return;
+	}
+
+	for (int k = 0; k < count; k++)
+		samples[k] = glm::vec4(uniform(generator), uniform(generator), uniform(generator), uniform(generator));
+}
+
+void generateSamples(SampleSequence sequence, int count, mt19937& generator, glm::vec4* samples)
+{
+	generateSampleRange(sequence, 0, count, randomRotation(generator), generator, samples);
+}
+
+const char* getSampleSequenceName(SampleSequence sequence)
+{
+	switch (sequence)
+	{
+	case SAMPLES_STRATIFIED: return "stratified";
+	case SAMPLES_HALTON: return "halton";
+	case SAMPLES_SOBOL: return "sobol";
+	default: return "random";
+	}
+}
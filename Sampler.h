@@ -0,0 +1,42 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "RadiosityOptions.h"
+#include "HemisphereSampling.h"
+
+#include <random>
+
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/glm.hpp>
+
+using namespace std;
+
+#define SOBOL_DIMENSIONS	4
+#define SOBOL_BITS			32
+
+// Fills samples with count points in [0,1)^4 for one patch: x and y place the point on the
+// patch, z and w pick the cosine weighted direction. Halton and Sobol points are shifted by one
+// random offset per call (Cranley-Patterson rotation) so patches get independent sets that keep
+// their low discrepancy. Stratified jitters a grid over the position and one over the direction
+// and pairs their cells in random order.
+void generateSamples(SampleSequence sequence, int count, mt19937& generator, glm::vec4* samples);
+
+// points first .. first + count - 1 of the same set, for callers that extend it in batches.
+// rotation is the Cranley-Patterson offset and must stay the same for every batch of a set,
+// stratified batches are stratified on their own.
+void generateSampleRange(SampleSequence sequence, int first, int count, glm::vec4 rotation, mt19937& generator, glm::vec4* samples);
+glm::vec4 randomRotation(mt19937& generator);
+
+// digits of index in the given base mirrored around the decimal point
+float radicalInverse(int base, unsigned int index);
+
+// component dimension (0 .. SOBOL_DIMENSIONS - 1) of Sobol point index
+float sobolSample(int dimension, unsigned int index);
+
+// cosine weighted direction around +z from two uniform numbers, see HemisphereSampling.h for any other frame
+glm::vec3 cosineWeightedDirection(float u, float v);
+
+const char* getSampleSequenceName(SampleSequence sequence);
+
+#endif
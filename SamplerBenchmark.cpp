@@ -0,0 +1,101 @@
+// Variance of the form factor estimate against the sample count for every sample sequence.
+// Build it on its own with Sampler.cpp.
+//
+//   SamplerBenchmark [distance] [trials]
+//
+// Rays leave a unit square with the same (position, cosine weighted direction) estimator as
+// Radiosity::calculateFormFactorsForFace and are counted when they hit a parallel unit square
+// at the given distance (default 1). The hit fraction is compared with the analytic form factor.
+
+#include "Sampler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+
+using namespace std;
+
+#define BENCHMARK_MIN_SAMPLES	16
+#define BENCHMARK_MAX_SAMPLES	4096
+
+// directly opposed parallel rectangles width x height at distance c (Howell, catalog C-11)
+static double parallelRectanglesFormFactor(double width, double height, double c)
+{
+	double X = width / c;
+	double Y = height / c;
+	double X2 = X * X, Y2 = Y * Y;
+
+	double result = log(sqrt((1 + X2) * (1 + Y2) / (1 + X2 + Y2)));
+	result += X * sqrt(1 + Y2) * atan(X / sqrt(1 + Y2));
+	result += Y * sqrt(1 + X2) * atan(Y / sqrt(1 + X2));
+	result -= X * atan(X) + Y * atan(Y);
+	return result * 2.0 / (3.14159265359 * X * Y);
+}
+
+static double estimateFormFactor(SampleSequence sequence, int count, double distance, mt19937& generator, vector<glm::vec4>& samples)
+{
+	generateSamples(sequence, count, generator, &samples[0]);
+
+	int hits = 0;
+	for (int k = 0; k < count; k++)
+	{
+		glm::vec3 origin(samples[k].x, samples[k].y, 0.0f);
+		glm::vec3 direction = cosineWeightedDirection(samples[k].z, samples[k].w);
+		if (direction.z <= 0.0f)
+			continue;
+
+		float t = (float)distance / direction.z;
+		glm::vec3 hit = origin + t * direction;
+		if (hit.x >= 0.0f && hit.x <= 1.0f && hit.y >= 0.0f && hit.y <= 1.0f)
+			hits++;
+	}
+	return (double)hits / count;
+}
+
+int main(int argc, char* argv[])
+{
+	double distance = argc > 1 ? atof(argv[1]) : 1.0;
+	int trials = argc > 2 ? atoi(argv[2]) : 200;
+	if (distance <= 0.0 || trials < 2)
+	{
+		printf("usage: SamplerBenchmark [distance > 0] [trials >= 2]\n");
+		return 1;
+	}
+
+	double reference = parallelRectanglesFormFactor(1.0, 1.0, distance);
+	printf("unit squares %.3f apart, analytic form factor %f, %d trials per cell\n\n", distance, reference, trials);
+
+	const SampleSequence sequences[] = { SAMPLES_RANDOM, SAMPLES_STRATIFIED, SAMPLES_HALTON, SAMPLES_SOBOL };
+	const int sequenceCount = sizeof(sequences) / sizeof(sequences[0]);
+
+	printf("%8s", "samples");
+	for (int s = 0; s < sequenceCount; s++)
+		printf(" %16s", getSampleSequenceName(sequences[s]));
+	printf("    (root mean square error, variance reduction over random in brackets)\n");
+
+	mt19937 generator(12345);
+	vector<glm::vec4> samples(BENCHMARK_MAX_SAMPLES);
+
+	for (int count = BENCHMARK_MIN_SAMPLES; count <= BENCHMARK_MAX_SAMPLES; count *= 2)
+	{
+		printf("%8d", count);
+		double randomError = 0.0;
+		for (int s = 0; s < sequenceCount; s++)
+		{
+			double sumSquared = 0.0;
+			for (int t = 0; t < trials; t++)
+			{
+				double error = estimateFormFactor(sequences[s], count, distance, generator, samples) - reference;
+				sumSquared += error * error;
+			}
+
+			double meanSquared = sumSquared / trials;
+			if (s == 0)
+				randomError = meanSquared;
+			printf(" %8.5f (%4.1fx)", sqrt(meanSquared), meanSquared > 0.0 ? randomError / meanSquared : 0.0);
+		}
+		printf("\n");
+	}
+	return 0;
+}
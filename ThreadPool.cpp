@@ -0,0 +1,77 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(int threadCount)
+{
+	if (threadCount <= 0)
+		threadCount = thread::hardware_concurrency();
+	if (threadCount <= 0)
+		threadCount = 1;
+
+	nextIndex = 0;
+	taskCount = 0;
+	activeWorkers = 0;
+	jobGeneration = 0;
+	stopping = false;
+
+	for (int i = 0; i < threadCount; i++)
+		workers.push_back(thread(&ThreadPool::workerLoop, this, i));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		lock_guard<mutex> lock(jobMutex);
+		stopping = true;
+	}
+	jobReady.notify_all();
+
+	for (int i = 0; i < workers.size(); i++)
+		workers[i].join();
+}
+
+void ThreadPool::parallelFor(int count, function<void(int, int)> task)
+{
+	if (count <= 0)
+		return;
+
+	{
+		lock_guard<mutex> lock(jobMutex);
+		currentTask = task;
+		taskCount = count;
+		nextIndex = 0;
+		activeWorkers = workers.size();
+		jobGeneration++;
+	}
+	jobReady.notify_all();
+
+	unique_lock<mutex> lock(jobMutex);
+	jobDone.wait(lock, [this] { return activeWorkers == 0; });
+	currentTask = nullptr;
+}
+
+void ThreadPool::workerLoop(int threadIndex)
+{
+	unsigned long long seenGeneration = 0;
+
+	while (true)
+	{
+		{
+			unique_lock<mutex> lock(jobMutex);
+			jobReady.wait(lock, [&] { return stopping || jobGeneration != seenGeneration; });
+			if (stopping)
+				return;
+			seenGeneration = jobGeneration;
+		}
+
+		int index;
+		while ((index = nextIndex++) < taskCount)
+			currentTask(index, threadIndex);
+
+		{
+			lock_guard<mutex> lock(jobMutex);
+			activeWorkers--;
+			if (activeWorkers == 0)
+				jobDone.notify_all();
+		}
+	}
+}
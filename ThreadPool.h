@@ -0,0 +1,43 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+using namespace std;
+
+// Fixed set of worker threads that split index ranges between them. Indexes are
+// handed out one at a time so uneven work per index still balances across cores.
+class ThreadPool
+{
+public:
+	ThreadPool(int threadCount = 0); // 0 uses every hardware thread
+	~ThreadPool();
+
+	int getThreadCount() { return workers.size(); }
+
+	// runs task(index, threadIndex) for every index in [0, count) and blocks until all are done
+	void parallelFor(int count, function<void(int, int)> task);
+
+private:
+	void workerLoop(int threadIndex);
+
+	vector<thread> workers;
+
+	mutex jobMutex;
+	condition_variable jobReady;
+	condition_variable jobDone;
+
+	function<void(int, int)> currentTask;
+	atomic<int> nextIndex;
+	int taskCount;
+	int activeWorkers;
+	unsigned long long jobGeneration;
+	bool stopping;
+};
+
+#endif
@@ -0,0 +1,208 @@
+#include "UniformGrid.h"
+
+#include <float.h>
+#include <math.h>
+#include <algorithm>
+
+static GridTriangle makeTriangle(glm::vec3 a, glm::vec3 b, glm::vec3 c, int patchIndex)
+{
+	GridTriangle triangle;
+	triangle.v0 = a;
+	triangle.edge1 = b - a;
+	triangle.edge2 = c - a;
+	triangle.patchIndex = patchIndex;
+	return triangle;
+}
+
+// Moller-Trumbore against the unnormalised segment direction, returns the segment parameter or -1 on a miss
+static float intersectTriangle(const GridTriangle& triangle, glm::vec3& origin, glm::vec3& direction)
+{
+	glm::vec3 pvec = glm::cross(direction, triangle.edge2);
+	float det = glm::dot(triangle.edge1, pvec);
+
+	if (fabs(det) < 1e-12f)
+		return -1.0f;
+
+	float invDet = 1.0f / det;
+
+	glm::vec3 tvec = origin - triangle.v0;
+	float u = glm::dot(tvec, pvec) * invDet;
+	if (u < 0.0f || u > 1.0f)
+		return -1.0f;
+
+	glm::vec3 qvec = glm::cross(tvec, triangle.edge1);
+	float v = glm::dot(direction, qvec) * invDet;
+	if (v < 0.0f || (u + v) > 1.0f)
+		return -1.0f;
+
+	return glm::dot(triangle.edge2, qvec) * invDet;
+}
+
+void UniformGrid::clear()
+{
+	triangles.clear();
+	cellOffsets.clear();
+	cellTriangles.clear();
+	cellSize = glm::vec3(0.0f);
+	resolution = glm::ivec3(0);
+}
+
+glm::ivec3 UniformGrid::getCell(glm::vec3 point) const
+{
+	glm::vec3 position = (point - boundsMin) / cellSize;
+	glm::ivec3 cell;
+	for (int axis = 0; axis < 3; axis++)
+		cell[axis] = glm::clamp((int)floorf(position[axis]), 0, resolution[axis] - 1);
+	return cell;
+}
+
+void UniformGrid::build(PatchTable& patches)
+{
+	clear();
+
+	for (int k = 0; k < patches.size(); k++)
+	{
+		if (patches.cornerCount[k] == 4)
+		{
+			triangles.push_back(makeTriangle(patches.a[k], patches.b[k], patches.d[k], k));
+			triangles.push_back(makeTriangle(patches.b[k], patches.c[k], patches.d[k], k));
+		}
+		else
+			triangles.push_back(makeTriangle(patches.a[k], patches.b[k], patches.c[k], k));
+	}
+
+	if (triangles.empty())
+		return;
+
+	boundsMin = glm::vec3(FLT_MAX);
+	boundsMax = glm::vec3(-FLT_MAX);
+	for (int i = 0; i < triangles.size(); i++)
+	{
+		GridTriangle& t = triangles[i];
+		boundsMin = glm::min(boundsMin, glm::min(t.v0, glm::min(t.v0 + t.edge1, t.v0 + t.edge2)));
+		boundsMax = glm::max(boundsMax, glm::max(t.v0, glm::max(t.v0 + t.edge1, t.v0 + t.edge2)));
+	}
+
+	// flat scenes still need a volume, and points on the outer faces must land inside
+	glm::vec3 extent = boundsMax - boundsMin;
+	float padding = max(max(extent.x, max(extent.y, extent.z)) * 1e-3f, GRID_SEGMENT_EPSILON);
+	boundsMin -= glm::vec3(padding);
+	boundsMax += glm::vec3(padding);
+	extent = boundsMax - boundsMin;
+
+	// cubic cells sized so the grid holds about GRID_CELLS_PER_TRIANGLE cells per triangle
+	float volume = extent.x * extent.y * extent.z;
+	float cellsPerLength = cbrtf(GRID_CELLS_PER_TRIANGLE * triangles.size() / volume);
+	for (int axis = 0; axis < 3; axis++)
+		resolution[axis] = glm::clamp((int)(extent[axis] * cellsPerLength), 1, GRID_MAX_RESOLUTION);
+	cellSize = extent / glm::vec3(resolution);
+
+	// two passes over the cells each triangle's bounds overlap: count, then fill
+	vector<glm::ivec3> firstCell(triangles.size()), lastCell(triangles.size());
+	cellOffsets.assign(getCellCount() + 1, 0);
+	for (int i = 0; i < triangles.size(); i++)
+	{
+		GridTriangle& t = triangles[i];
+		firstCell[i] = getCell(glm::min(t.v0, glm::min(t.v0 + t.edge1, t.v0 + t.edge2)));
+		lastCell[i] = getCell(glm::max(t.v0, glm::max(t.v0 + t.edge1, t.v0 + t.edge2)));
+
+		for (int z = firstCell[i].z; z <= lastCell[i].z; z++)
+			for (int y = firstCell[i].y; y <= lastCell[i].y; y++)
+				for (int x = firstCell[i].x; x <= lastCell[i].x; x++)
+					cellOffsets[getCellIndex(x, y, z) + 1]++;
+	}
+	for (int c = 0; c < getCellCount(); c++)
+		cellOffsets[c + 1] += cellOffsets[c];
+
+	cellTriangles.resize(cellOffsets.back());
+	vector<int> cursor(cellOffsets.begin(), cellOffsets.end() - 1);
+	for (int i = 0; i < triangles.size(); i++)
+		for (int z = firstCell[i].z; z <= lastCell[i].z; z++)
+			for (int y = firstCell[i].y; y <= lastCell[i].y; y++)
+				for (int x = firstCell[i].x; x <= lastCell[i].x; x++)
+					cellTriangles[cursor[getCellIndex(x, y, z)]++] = i;
+}
+
+bool UniformGrid::isOccluded(glm::vec3 from, glm::vec3 to, int ignoreA, int ignoreB) const
+{
+	if (triangles.empty())
+		return false;
+
+	glm::vec3 direction = to - from;
+	float length = glm::length(direction);
+	if (length <= 2.0f * GRID_SEGMENT_EPSILON)
+		return false;
+
+	// hits count on the open segment, away from the surfaces the end points usually lie on
+	float tNear = GRID_SEGMENT_EPSILON / length;
+	float tFar = 1.0f - tNear;
+
+	// clip the segment to the grid bounds
+	float tEnter = 0.0f, tExit = 1.0f;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (direction[axis] == 0.0f)
+		{
+			if (from[axis] < boundsMin[axis] || from[axis] > boundsMax[axis])
+				return false;
+			continue;
+		}
+		float t1 = (boundsMin[axis] - from[axis]) / direction[axis];
+		float t2 = (boundsMax[axis] - from[axis]) / direction[axis];
+		tEnter = max(tEnter, min(t1, t2));
+		tExit = min(tExit, max(t1, t2));
+	}
+	if (tEnter > tExit)
+		return false;
+
+	// 3D DDA: tMax is where the segment leaves the current cell along each axis, tDelta the width of a cell
+	glm::ivec3 cell = getCell(from + direction * tEnter);
+	glm::ivec3 step;
+	glm::vec3 tMax, tDelta;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (direction[axis] > 0.0f)
+		{
+			step[axis] = 1;
+			tMax[axis] = (boundsMin[axis] + (cell[axis] + 1) * cellSize[axis] - from[axis]) / direction[axis];
+			tDelta[axis] = cellSize[axis] / direction[axis];
+		}
+		else if (direction[axis] < 0.0f)
+		{
+			step[axis] = -1;
+			tMax[axis] = (boundsMin[axis] + cell[axis] * cellSize[axis] - from[axis]) / direction[axis];
+			tDelta[axis] = -cellSize[axis] / direction[axis];
+		}
+		else
+		{
+			step[axis] = 0;
+			tMax[axis] = FLT_MAX;
+			tDelta[axis] = FLT_MAX;
+		}
+	}
+
+	while (true)
+	{
+		// triangles spanning several cells may be tested more than once, any hit on the segment counts
+		int c = getCellIndex(cell.x, cell.y, cell.z);
+		for (int k = cellOffsets[c]; k < cellOffsets[c + 1]; k++)
+		{
+			const GridTriangle& triangle = triangles[cellTriangles[k]];
+			if (triangle.patchIndex == ignoreA || triangle.patchIndex == ignoreB)
+				continue;
+
+			float t = intersectTriangle(triangle, from, direction);
+			if (t > tNear && t < tFar)
+				return true;
+		}
+
+		int axis = tMax.x < tMax.y ? (tMax.x < tMax.z ? 0 : 2) : (tMax.y < tMax.z ? 1 : 2);
+		if (tMax[axis] > tExit)
+			return false;
+
+		cell[axis] += step[axis];
+		if (cell[axis] < 0 || cell[axis] >= resolution[axis])
+			return false;
+		tMax[axis] += tDelta[axis];
+	}
+}
@@ -0,0 +1,58 @@
+#ifndef UNIFORM_GRID_H
+#define UNIFORM_GRID_H
+
+#include "PatchTable.h"
+
+#include <vector>
+
+#include <glm/vec3.hpp>
+#include <glm/glm.hpp>
+
+using namespace std;
+
+#define GRID_CELLS_PER_TRIANGLE		2.0f // target cell count relative to the triangle count
+#define GRID_MAX_RESOLUTION			128 // cells along one axis at most
+#define GRID_SEGMENT_EPSILON		0.001f // hits this close to either end of a segment are ignored, like BVH_RAY_EPSILON
+
+struct GridTriangle
+{
+	glm::vec3 v0;
+	glm::vec3 edge1;
+	glm::vec3 edge2;
+	int patchIndex; // index into the radiosity scene faces
+};
+
+// Uniform grid over the radiosity patches for point to point visibility. The BVH answers
+// closest hit queries for the form factor rays, this answers whether anything at all lies
+// between two points: the segment walks the cells it crosses (Amanatides and Woo) and returns
+// on the first blocking triangle. Quads are split into ABD and BCD like in the BVH. Queries
+// only read the grid and allocate nothing, so any number of threads can run them at once.
+class UniformGrid
+{
+public:
+	UniformGrid() : cellSize(0.0f), resolution(0) {}
+
+	void build(PatchTable& patches);
+	void clear();
+
+	// true if a triangle of any patch other than ignoreA and ignoreB crosses the open segment
+	// from -> to, pass -1 to ignore nothing
+	bool isOccluded(glm::vec3 from, glm::vec3 to, int ignoreA = -1, int ignoreB = -1) const;
+
+	int getCellCount() { return resolution.x * resolution.y * resolution.z; }
+	int getReferenceCount() { return cellTriangles.size(); }
+
+private:
+	int getCellIndex(int x, int y, int z) const { return (z * resolution.y + y) * resolution.x + x; }
+	glm::ivec3 getCell(glm::vec3 point) const;
+
+	vector<GridTriangle> triangles;
+	vector<int> cellOffsets; // cell c lists triangles [cellOffsets[c], cellOffsets[c+1]) of cellTriangles
+	vector<int> cellTriangles;
+
+	glm::vec3 boundsMin, boundsMax;
+	glm::vec3 cellSize;
+	glm::ivec3 resolution;
+};
+
+#endif
@@ -6,12 +6,13 @@
 extern GLFWwindow* window;
 bool hasInterp = false;
 
-UserControls::UserControls(glm::vec3 pos, float hAngle, float vAngle, bool interpolate)
+UserControls::UserControls(glm::vec3 pos, float hAngle, float vAngle, bool interpolate, bool async)
 {
 	currentPosition = pos;
 	currentHorizontalAngle = hAngle;
 	currentVerticalAngle = vAngle;
 	interpolateColors = interpolate;
+	asyncSolve = async;
 }
 
 glm::mat4 UserControls::getViewMatrix()
@@ -29,7 +30,11 @@ void UserControls::handleKeyboard(Mesh* mesh, Radiosity* radiosity)
 	//Subdivide
 	if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)// && !hasInterp)
 	{
-		if (glfwGetKey(window, GLFW_KEY_E) == GLFW_RELEASE)
+		if (glfwGetKey(window, GLFW_KEY_E) == GLFW_RELEASE && radiosity->isSolving())
+		{
+			printf("Wait for the radiosity solve to finish\n");
+		}
+		else if (glfwGetKey(window, GLFW_KEY_E) == GLFW_RELEASE)
 		{
 			printf("Subdividing mesh...\n");
 			mesh->Subdivide();
@@ -45,7 +50,11 @@ void UserControls::handleKeyboard(Mesh* mesh, Radiosity* radiosity)
 	//Reset
 	if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS)
 	{
-		if (glfwGetKey(window, GLFW_KEY_R) == GLFW_RELEASE)
+		if (glfwGetKey(window, GLFW_KEY_R) == GLFW_RELEASE && radiosity->isSolving())
+		{
+			printf("Wait for the radiosity solve to finish\n");
+		}
+		else if (glfwGetKey(window, GLFW_KEY_R) == GLFW_RELEASE)
 		{
 			printf("Resetting mesh...\n");
 			mesh->ResetMesh();
@@ -64,17 +73,28 @@ void UserControls::handleKeyboard(Mesh* mesh, Radiosity* radiosity)
 		if (glfwGetKey(window, GLFW_KEY_I) == GLFW_RELEASE)
 		{
 			hasInterp = true;
-			printf("Radiosity iteration. Please wait, this could take a while...\n");
-
-			printf("Calculating radiosity values...\n");
-			radiosity->calculateRadiosityValues();
-			printf("Preparing to re-draw scene...\n");
-			radiosity->setMeshFaceColors();
-			if (interpolateColors)
-				mesh->cacheVerticesFacesAndColors_Radiosity_II();
+			if (asyncSolve)
+			{
+				//the render loop picks up the snapshots with applySnapshotToMesh
+				if (radiosity->startAsyncSolve())
+					printf("Radiosity iteration started in the background...\n");
+				else
+					printf("A radiosity solve is already running\n");
+			}
 			else
-				mesh->cacheVerticesFacesAndColors();
-			mesh->PrepareToDraw();
+			{
+				printf("Radiosity iteration. Please wait, this could take a while...\n");
+
+				printf("Calculating radiosity values...\n");
+				radiosity->calculateRadiosityValues();
+				printf("Preparing to re-draw scene...\n");
+				radiosity->setMeshFaceColors();
+				if (interpolateColors)
+					mesh->cacheVerticesFacesAndColors_Radiosity_II();
+				else
+					mesh->cacheVerticesFacesAndColors();
+				mesh->PrepareToDraw();
+			}
 		}
 	}
 
@@ -173,19 +193,41 @@ void UserControls::computeMatrices(float initialFoV, float nearClippingPlane, fl
 		);
 	}
 
-	// Projection matrix : 45 Field of View, 4:3 ratio, display range : 0.1 unit <-> 100 units
 	if (windowHeight == 0)
 		windowHeight = 1;
 	float windowRatio = (float)windowWidth / (float)windowHeight;
-	ProjectionMatrix = glm::perspective(initialFoV, windowRatio, nearClippingPlane, farClippingPlane);
+	computeCameraMatrices(currentPosition, currentHorizontalAngle, currentVerticalAngle, initialFoV, windowRatio, nearClippingPlane, farClippingPlane, ProjectionMatrix, ViewMatrix);
+
+	// For the next frame, the "last time" will be "now"
+	lastTime = currentTime;
+}
+
+void UserControls::computeCameraMatrices(glm::vec3 position, float hAngle, float vAngle, float initialFoV, float windowRatio, float nearClippingPlane, float farClippingPlane, glm::mat4& projection, glm::mat4& view)
+{
+	// Direction : Spherical coordinates to Cartesian coordinates conversion
+	glm::vec3 direction(
+		cos(vAngle) * sin(hAngle),
+		sin(vAngle),
+		cos(vAngle) * cos(hAngle)
+	);
+
+	// Right vector
+	glm::vec3 right = glm::vec3(
+		sin(hAngle - 3.14f / 2.0f),
+		0,
+		cos(hAngle - 3.14f / 2.0f)
+	);
+
+	// Up vector
+	glm::vec3 up = glm::cross(right, direction);
+
+	// Projection matrix : 45 Field of View, 4:3 ratio, display range : 0.1 unit <-> 100 units
+	projection = glm::perspective(initialFoV, windowRatio, nearClippingPlane, farClippingPlane);
 
 	// Camera matrix
-	ViewMatrix = glm::lookAt(
-		currentPosition,			// Camera is here
-		currentPosition + direction,	// and looks here : at the same position, plus "direction"
+	view = glm::lookAt(
+		position,			// Camera is here
+		position + direction,	// and looks here : at the same position, plus "direction"
 		up							// Head is up (set to 0,-1,0 to look upside-down)
 	);
-
-	// For the next frame, the "last time" will be "now"
-	lastTime = currentTime;
-}
\ No newline at end of file
+}
@@ -9,9 +9,11 @@
 class UserControls
 {
 	public:
-	UserControls(glm::vec3 pos, float hAngle, float vAngle, bool interpolate);
+	UserControls(glm::vec3 pos, float hAngle, float vAngle, bool interpolate, bool async);
 	void handleKeyboard(Mesh* mesh, Radiosity* radiosity);
 	void computeMatrices(float initFoV, float nearClip, float farClip, float speed, float mouseSpeed);
+	// camera matrices for a fixed position and orientation, needs no window
+	static void computeCameraMatrices(glm::vec3 position, float hAngle, float vAngle, float initFoV, float windowRatio, float nearClip, float farClip, glm::mat4& projection, glm::mat4& view);
 	glm::mat4 getViewMatrix();
 	glm::mat4 getProjectionMatrix();
 
@@ -26,6 +28,7 @@ class UserControls
 	// Initial vertical angle : none
 	float currentVerticalAngle;
 	bool interpolateColors;
+	bool asyncSolve;
 };
 
 #endif
\ No newline at end of file
@@ -26,6 +26,90 @@ using namespace std;
 #include "Radiosity.h"
 #include "UserControls.h"
 
+// Each pass solves the current mesh, then splits only the patches on strong radiosity
+// gradients or shadow boundaries and reloads the faces. Stops early once nothing is marked.
+// Returns true if the last solve is still valid for the current faces, false if the final
+// pass subdivided after solving.
+bool refineAdaptively(Mesh* mesh, Radiosity* radiosity, int passes)
+{
+	for (int i = 0; i < passes; i++)
+	{
+		printf("Adaptive pass: %d\n", i);
+		radiosity->calculateRadiosityValues();
+
+		vector<vector<bool>> marks;
+		if (radiosity->markFacesForRefinement(mesh, marks) == 0)
+			return true;
+
+		mesh->Subdivide(&marks);
+		radiosity->loadSceneFacesFromMesh(mesh);
+		radiosity->PrepareUnshotRadiosityValues();
+	}
+	return passes <= 0;
+}
+
+// Batch solve for machines without a display: loads, subdivides, solves and writes
+// the per patch results (and optionally a software rendered image). Nothing on this
+// path calls GLFW or GLEW.
+int runHeadless(ArgParser& argParser)
+{
+	Mesh* mesh = new Mesh();
+	mesh->SetIndexedVertices(argParser.indexedVertices);
+	Radiosity* radiosity = new Radiosity();
+	radiosity->setOptions(argParser.radiosityOptions);
+
+	mesh->Load(argParser.sceneName);
+
+	printf("Loading faces...\n");
+	radiosity->loadSceneFacesFromMesh(mesh);
+
+	for (int i = 0; i < argParser.numSubdivisions; i++)
+	{
+		printf("LOD: %d\n", i);
+		mesh->Subdivide();
+		radiosity->loadSceneFacesFromMesh(mesh);
+		radiosity->PrepareUnshotRadiosityValues();
+	}
+
+	refineAdaptively(mesh, radiosity, argParser.adaptivePasses);
+
+	int iterations = argParser.numIterations > 0 ? argParser.numIterations : 1;
+	printf("Calculating radiosity solution for scene. This could take a while...\n");
+	for (int i = 0; i < iterations; i++)
+	{
+		printf("Radiosity iteration: %d\n", i);
+		radiosity->calculateRadiosityValues();
+		radiosity->setMeshFaceColors();
+	}
+
+	time_t now = time(0);
+	string resultsName = argParser.resultsFile.empty() ? to_string(now).append(".csv") : argParser.resultsFile;
+	if (radiosity->writePatchResults(resultsName))
+		printf("Patch results saved: %s\n", resultsName.c_str());
+
+	if (!argParser.imageFile.empty())
+	{
+		printf("Caching vertex positions and colors...\n");
+		if (argParser.interpolate)
+			mesh->cacheVerticesFacesAndColors_Radiosity_II();
+		else
+			mesh->cacheVerticesFacesAndColors();
+
+		glm::mat4 ProjectionMatrix, ViewMatrix;
+		int windowHeight = argParser.windowHeight > 0 ? argParser.windowHeight : 1;
+		float windowRatio = (float)argParser.windowWidth / (float)windowHeight;
+		UserControls::computeCameraMatrices(argParser.cameraPosition, argParser.horizontalAngle, argParser.verticalAngle,
+			argParser.initialFoV, windowRatio, argParser.nearClippingPlane, argParser.farClippingPlane, ProjectionMatrix, ViewMatrix);
+		mesh->SetMVP(ProjectionMatrix * ViewMatrix * glm::mat4(1.0));
+
+		mesh->RasterizeToBitmap(argParser.imageFile, argParser.windowWidth, windowHeight, argParser.bgcolor);
+		printf("Image saved: %s\n", argParser.imageFile.c_str());
+	}
+
+	delete radiosity;
+	delete mesh;
+	return 0;
+}
 
 int main(int argc, char *argv[])
 {
@@ -33,6 +117,9 @@ int main(int argc, char *argv[])
 	
 	ArgParser argParser(argc, argv);
 
+	if (argParser.headless)
+		return runHeadless(argParser);
+
 	// Initialise GLFW
 	if (!glfwInit())
 	{
@@ -84,10 +171,13 @@ int main(int argc, char *argv[])
 		argParser.cameraPosition,
 		argParser.horizontalAngle,
 		argParser.verticalAngle,
-		argParser.interpolate
+		argParser.interpolate,
+		argParser.asyncSolve
 	);
 	Mesh* mesh = new Mesh();
+	mesh->SetIndexedVertices(argParser.indexedVertices);
 	Radiosity* radiosity = new Radiosity();
+	radiosity->setOptions(argParser.radiosityOptions);
 
 	mesh->Load(argParser.sceneName);
 
@@ -118,6 +208,19 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (argParser.adaptivePasses > 0)
+	{
+		// solve the refined faces if the last pass split them, then show that solution
+		if (!refineAdaptively(mesh, radiosity, argParser.adaptivePasses))
+			radiosity->calculateRadiosityValues();
+		radiosity->setMeshFaceColors();
+		if (argParser.interpolate)
+			mesh->cacheVerticesFacesAndColors_Radiosity_II();
+		else
+			mesh->cacheVerticesFacesAndColors();
+		mesh->PrepareToDraw();
+	}
+
 	//now we draw
 	do
 	{
@@ -176,6 +279,17 @@ int main(int argc, char *argv[])
 		}
 
 		userControls.handleKeyboard(mesh, radiosity);
+
+		//show the newest intermediate solution of a background solve
+		if (radiosity->applySnapshotToMesh())
+		{
+			if (argParser.interpolate)
+				mesh->cacheVerticesFacesAndColors_Radiosity_II();
+			else
+				mesh->cacheVerticesFacesAndColors();
+			mesh->PrepareToDraw();
+		}
+
 		//draw the mesh
 		mesh->Draw();
 
@@ -193,6 +307,8 @@ int main(int argc, char *argv[])
 	} // Check if the ESC key was pressed or the window was closed
 	while (glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS && glfwWindowShouldClose(window) == 0);
 
+	radiosity->stopAsyncSolve();
+
 	// Cleanup mesh VBO
 	mesh->Cleanup();
 